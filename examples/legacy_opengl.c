@@ -12,7 +12,24 @@
 #define SCREENWIDTH 600
 #define SCREENHEIGHT 600
 
-Frame frame;
+// Triple buffered: the render thread fills frames[writeIndex] and hands it over as frames[readyIndex], the display
+// shows frames[presentIndex]. Neither side waits for the other to finish a frame.
+#define FRAME_BUFFER_COUNT 3
+
+typedef struct FrameStats {
+    float frameTime;
+    RenderSettings settings;
+} FrameStats;
+
+Frame frames[FRAME_BUFFER_COUNT];
+FrameStats frameStats[FRAME_BUFFER_COUNT];
+uint32_t writeIndex = 0;
+uint32_t readyIndex = 1;
+uint32_t presentIndex = 2;
+uint8_t frameReady = 0;
+pthread_mutex_t swapMutex = PTHREAD_MUTEX_INITIALIZER;
+
+Frame renderFrame;
 
 #define malloc(x)
 #define calloc(x)
@@ -20,18 +37,81 @@ Frame frame;
 
 #define UNUSED(x) (void)(x)
 
+// Everything the scenes hold lives in these, no allocation happens after the first frame.
+uint8_t resourceMemory[4096];
+uint8_t sceneMemory[16384];
+uint8_t renderSceneMemory[16384];
+Arena resourceArena;
+Arena sceneArena;
+Arena renderSceneArena;
+
 ResourcePool resourcePool;
 Scene scene;
+Scene renderScene;
+LightHandle sunLight;
+
+// Only the render thread touches these.
+RenderJob renderJob;
+BudgetController budgetController;
+ColorPipeline colorPipeline;
+pthread_t renderThread;
+// onIdle animates scene while the render thread snapshots it at the start of every frame.
+pthread_mutex_t sceneMutex = PTHREAD_MUTEX_INITIALIZER;
 
 uint8_t tick = 0;
 
 char frame_time_str[32] = "Frame time";
+char ray_rate_str[32] = "";
+char settings_str[32] = "";
+
+TextOverlay frameTimeOverlay;
+TextOverlay rayRateOverlay;
+TextOverlay settingsOverlay;
+
+// Renders frames back to back, the display thread only ever sees finished ones.
+void *renderLoop(void *userData) {
+    UNUSED(userData);
+
+    for (;;) {
+        // Frame boundary: scene updates made after the snapshot belong to the next frame.
+        pthread_mutex_lock(&sceneMutex);
+        scene_copy(&renderScene, &scene);
+        pthread_mutex_unlock(&sceneMutex);
+
+        RenderSettings const settings = budgetController.settings;
+        RenderView const view = {&(renderScene.camera), renderFrame.data, settings.width, settings.height, settings.samplesPerPixel, settings.maxDepth, 0, NULL};
+        scene_render_view_async(&renderJob, &renderScene, &view, NULL, NULL);
+        float const frameTime = renderjob_wait(&renderJob);
+        budgetcontroller_update(&budgetController, frameTime);
+
+        frame_upscale(&frames[writeIndex], renderFrame.data, settings.width, settings.height, 0, 0, settings.width, settings.height);
+        // Display-ready before it is handed over, the overlays are drawn on top with their exact colors.
+        frame_tonemap(&frames[writeIndex], &colorPipeline);
+        frameStats[writeIndex] = LITERAL(FrameStats){frameTime, settings};
+
+        // Publish the frame, an unpresented older one is simply overwritten next time.
+        pthread_mutex_lock(&swapMutex);
+        uint32_t const index = readyIndex;
+        readyIndex = writeIndex;
+        writeIndex = index;
+        frameReady = 1;
+        pthread_mutex_unlock(&swapMutex);
+    }
+
+    return NULL;
+}
 
 void onInitialization(void) {
     srand(time(NULL));
 	glViewport(0, 0, SCREENWIDTH, SCREENHEIGHT);
 
-    resourcePool = resourcepool_create();
+    resourceArena = arena_create(resourceMemory, sizeof(resourceMemory));
+    sceneArena = arena_create(sceneMemory, sizeof(sceneMemory));
+    renderSceneArena = arena_create(renderSceneMemory, sizeof(renderSceneMemory));
+
+    resourcePool = resourcepool_create(&resourceArena);
+    budgetController = budgetcontroller_create(1.0f / 30.0f);
+    colorPipeline = colorpipeline_create(0.0f, TM_ACES, 1);
 
     resourcepool_add_material(&resourcePool, material_emerald());
     resourcepool_add_material(&resourcePool, material_gold());
@@ -47,25 +127,38 @@ void onInitialization(void) {
     Vec3 ambient = {.x = 0.5f, .y = 0.6f, .z = 0.8f};
 
     Camera camera = camera_create(eye, lookat, up, fov);
-    scene = scene_create(camera, ambient);
+    scene = scene_create(&sceneArena, &resourcePool, camera, ambient);
+    renderScene = scene_create(&renderSceneArena, &resourcePool, camera, ambient);
 
     Vec3 lightDir = {.x = -1.0f, .y = -1.0f, .z = -1.0f};
-    Light light = {vec3_norm(lightDir), {.r = 0.8f, .g = 0.8f, .b = 0.8f}};
-    scene_add_light(&scene, light);
+    Light light = light_directional(lightDir, LITERAL(Vec3){.r = 0.8f, .g = 0.8f, .b = 0.8f});
+    sunLight = scene_add_light(&scene, light);
+
+    // A ring of coloured point lights, more than a hit shades exactly, so they are sampled through the light tree.
+    for (int i = 0; i < 16; ++i)
+    {
+        float const angle = 2.0f * 3.14159265f * (float)i / 16.0f;
+        Vec3 const position = {.x = 2.5f * cosf(angle), .y = 1.5f, .z = 2.5f * sinf(angle)};
+        Vec3 const intensity = {.r = rand_float(0.0f, 0.4f), .g = rand_float(0.0f, 0.4f), .b = rand_float(0.0f, 0.4f)};
+        scene_add_light(&scene, light_point(position, intensity));
+    }
+    scene_build_light_tree(&scene);
 
     for (int i = 0; i < 20; ++i)
     {
         Vec3 center = {.x = rand_float(-1.0f, 1.0f), .y = rand_float(-1.0f, 1.0f), .z = rand_float(-1.0f, 1.0f)};
         float radius = rand_float(0.2f, 0.4f);
-        int const materialIndex = rand_int(0, resourcePool.currentMaterialCount - 1);
-        Sphere sphere = {center, radius, &(resourcePool.materials[materialIndex])};
+        MaterialHandle const material = (MaterialHandle)rand_int(0, (int)resourcePool.materialCount - 1);
+        Sphere sphere = {center, radius, material};
         scene_add_sphere(&scene, sphere);
     }
 
     Vec3 center = {.x = 0.0f, .y = -102.0f, .z = 0.0f};
     float radius = 100.0f;
-    Sphere sphere = {center, radius, &(resourcePool.materials[rand_int(0, 0)])};
+    Sphere sphere = {center, radius, 0};
     scene_add_sphere(&scene, sphere);
+
+    pthread_create(&renderThread, NULL, renderLoop, NULL);
 }
 
 // Rajzolas, ha az alkalmazas ablak ervenytelenne valik, akkor ez a fuggveny hivodik meg
@@ -73,16 +166,42 @@ void onDisplay(void) {
     glClearColor(0.2f, 0.2f, 0.2f, 1.0f);		// torlesi szin beallitasa
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // kepernyo torles
 
-    float const frameTime = scene_render(&scene, &frame);
-    if (tick != 0) {
-        snprintf(frame_time_str, sizeof(frame_time_str), "Frame time %.2fMS", 1000 * frameTime);
+    uint8_t newFrame = 0;
+    pthread_mutex_lock(&swapMutex);
+    if (frameReady) {
+        uint32_t const index = presentIndex;
+        presentIndex = readyIndex;
+        readyIndex = index;
+        frameReady = 0;
+        newFrame = 1;
+    }
+    pthread_mutex_unlock(&swapMutex);
+
+    // The presented buffer belongs to this thread until the next swap.
+    Frame *const frame = &frames[presentIndex];
+    FrameStats const *const stats = &frameStats[presentIndex];
+
+    if (newFrame && tick != 0) {
+        // Primary rays only, secondary and shadow rays are not counted.
+        float const primaryRays = (float)stats->settings.width * (float)stats->settings.height * (float)stats->settings.samplesPerPixel;
+
+        snprintf(frame_time_str, sizeof(frame_time_str), "Frame time %.2fMS", 1000 * stats->frameTime);
+        snprintf(ray_rate_str, sizeof(ray_rate_str), "%.2f Mrays/s", primaryRays / (1e6f * stats->frameTime));
+        snprintf(settings_str, sizeof(settings_str), "%u spp %ux%u", stats->settings.samplesPerPixel, stats->settings.width, stats->settings.height);
     }
 
     Vec3 lineColor = LITERAL(Vec3){.r = 1.0f, .g = 1.0f, .b = 0.0f};
-    Vec2 offset = LITERAL(Vec2){.x = 20.0f, .y = 550.0f};
-    text_render(&frame, frame_time_str, offset, 8, lineColor);
 
-    glDrawPixels(FRAME_WIDTH, FRAME_HEIGHT, GL_RGB, GL_FLOAT, frame.data);
+    // Only changed strings are rasterized again.
+    textoverlay_set(&frameTimeOverlay, frame_time_str, LITERAL(Vec2){.x = 20.0f, .y = 570.0f}, 8);
+    textoverlay_set(&rayRateOverlay, ray_rate_str, LITERAL(Vec2){.x = 20.0f, .y = 555.0f}, 8);
+    textoverlay_set(&settingsOverlay, settings_str, LITERAL(Vec2){.x = 20.0f, .y = 540.0f}, 8);
+
+    textoverlay_render(frame, &frameTimeOverlay, lineColor);
+    textoverlay_render(frame, &rayRateOverlay, lineColor);
+    textoverlay_render(frame, &settingsOverlay, lineColor);
+    // With TRAYRACING_SIMD a pixel carries a fourth padding lane.
+    glDrawPixels(FRAME_WIDTH, FRAME_HEIGHT, sizeof(Vec3) == 4 * sizeof(float) ? GL_RGBA : GL_RGB, GL_FLOAT, frame->data);
 	
     glutSwapBuffers();     				// Buffercsere: rajzolas vege
 }
@@ -101,7 +220,7 @@ void onKeyboardUp(unsigned char key, int x, int y) {
 
     if (key == 32)
     {
-        frame_save_to_file(&frame);
+        frame_save_to_file(&frames[presentIndex]);
     }
 }
 
@@ -127,7 +246,9 @@ void onIdle(void) {
     tick = (time - (int)time < 1e-1f) ? 1 : 0;
 
     Vec3 const newDir = {.x = cosf(0.5f * time), .y = -1.0f, .z = sinf(0.5f * time)};
-    scene.lights[0].direction = vec3_norm(vec3_add(newDir, scene.lights[0].direction));
+    pthread_mutex_lock(&sceneMutex);
+    Light *const sun = scene_get_light(&scene, sunLight);
+    sun->direction = vec3_norm(vec3_add(newDir, sun->direction));
 
     Vec3 eye = {.x = 3.5f * cosf(0.25f * time), .y = scene.camera.eye.y, .z = 3.5f * sinf(0.25f * time)};
     Vec3 up = {.x = 0.0f, .y = 1.0f, .z = 0.0f};
@@ -135,6 +256,7 @@ void onIdle(void) {
     float fov = deg2rad(60.0f);
 
     scene.camera = camera_create(eye, lookat, up, fov);
+    pthread_mutex_unlock(&sceneMutex);
 
     glutPostRedisplay();
 }
@@ -1,6 +1,7 @@
 #ifndef TRAYRACING_H
 #define TRAYRACING_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -14,6 +15,39 @@
 
 #define BIT(n) (1ULL << (n))
 
+// For the static tables and helpers of the header that a translation unit including it may not use.
+#if defined(__GNUC__) || defined(__clang__)
+#define TRAYRACING_UNUSED __attribute__((unused))
+#else
+#define TRAYRACING_UNUSED
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TRAYRACING_POSIX
+#endif
+
+#ifdef TRAYRACING_POSIX
+#include <pthread.h>
+#endif
+
+// Define TRAYRACING_SIMD to back Vec3 with a 16-byte aligned SSE register and inline the vec3 functions everywhere.
+#ifdef TRAYRACING_SIMD
+#if !defined(__SSE2__) && !defined(_M_X64)
+#error "TRAYRACING_SIMD requires SSE2"
+#endif
+#include <emmintrin.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TRAYRACING_VEC_INLINE static inline __attribute__((always_inline))
+#else
+#define TRAYRACING_VEC_INLINE static __forceinline
+#endif
+#endif
+
+#ifndef PRECISION
+#define PRECISION 1e-4f
+#endif
+
 #ifndef FRAME_WIDTH
 #define FRAME_WIDTH 600
 #endif
@@ -30,12 +64,24 @@ typedef union Vec2 {
     struct { float s, t; };
 } Vec2;
 
+#ifdef TRAYRACING_SIMD
+// The fourth lane is padding. It is zero whenever the vector is built by a designated initializer, so it never
+// produces denormals, but it may hold anything and must never leak into x, y and z.
+typedef union Vec3 {
+    __m128 m;
+    float v[3];
+
+    struct { float x, y, z, _w; };
+    struct { float r, g, b, _a; };
+    struct { float s, t, u, _q; };
+#else
 typedef union Vec3 {
     float v[3];
 
     struct { float x, y, z; };
     struct { float r, g, b; };
     struct { float s, t, u; };
+#endif
 
     struct { Vec2 xy; };
     struct { Vec2 rg; };
@@ -45,9 +91,22 @@ typedef union Vec3 {
     struct { float _s; Vec2 tu; };
 } Vec3;
 
+typedef enum LightType {
+    LT_DIRECTIONAL = 0,
+    LT_POINT = 1,
+    LT_SPOT = 2
+} LightType;
+
+// Directional lights shine along direction with exitance. Point and spot lights radiate exitance as intensity from
+// position, falling off with the squared distance, spot lights only along direction and fading out between the
+// inner and the outer cone, given by the cosines of their half angles.
 typedef struct Light {
     Vec3 direction;
     Vec3 exitance;
+    Vec3 position;
+    float cosInner;
+    float cosOuter;
+    uint8_t type;
 } Light;
 
 typedef struct Camera {
@@ -78,39 +137,297 @@ typedef struct Material
     uint8_t flags;
 } Material;
 
+// Indices into the storage of a ResourcePool or Scene, they stay valid while the storage grows.
+typedef uint32_t MaterialHandle;
+typedef uint32_t SphereHandle;
+typedef uint32_t LightHandle;
+
+#define INVALID_HANDLE UINT32_MAX
+
 typedef struct Sphere {
     Vec3 center;
     float radius;
-    Material const *material;
+    MaterialHandle material;
 } Sphere;
 
 typedef enum Values {
-    MAX_MATERIAL_COUNT = 10,
-    MAX_SPHERE_COUNT = 128,
-    MAX_LIGHT_COUNT = 4,
     GLYPH_DATA_SIZE = 12,
-    SAMPLES_PER_PIXEL = 4
+    SAMPLES_PER_PIXEL = 4,
+    PACKED_CLUSTER_SIZE = 32,
+    TILE_SIZE = 32,
+    MAX_WORKER_COUNT = 64,
+    MAX_DAEMON_RESOLUTION = 4096,
+    MAX_DAEMON_SAMPLES = 1024,
+    MAX_RAY_DEPTH = 5,
+    DENOISE_ITERATIONS = 5,
+    DENOISE_BAND_HEIGHT = 8,
+    OVERLAY_MAX_TEXT_LENGTH = 64,
+    OVERLAY_MASK_HEIGHT = 64,
+    ARENA_ALIGNMENT = 16,
+    ARENA_INITIAL_CAPACITY = 16,
+    LIGHT_SAMPLES_PER_HIT = 4,
+    DIFF_IMAGE_GAIN = 16,
+    STREAM_CHUNK_SIZE = 256,
+    DAEMON_REQUEST_SIZE = 68,
+    DAEMON_RESPONSE_SIZE = 12,
+    FRAME_RING_MAGIC = 0x47524654,
+    FRAME_RING_MAX_SLOTS = 8,
+    FRAME_RING_HEADER_SIZE = 4096,
+    FRAME_RING_MAX_NAME = 64,
+    TILE_SPHERE_CAPACITY = 256,
+    COLOR_LUT_SIZE = 4096,
+    COLOR_BAND_HEIGHT = 16
 } Values;
 
+// Bump allocator over caller-owned memory, everything allocated from it is released at once by arena_reset.
+typedef struct Arena {
+    uint8_t *memory;
+    size_t capacity;
+    size_t used;
+} Arena;
+
+// Growable material storage in an arena.
 typedef struct ResourcePool {
-    uint8_t currentMaterialCount;
-    Material materials[MAX_MATERIAL_COUNT];
+    Arena *arena;
+    Material *materials;
+    uint32_t materialCount;
+    uint32_t materialCapacity;
 } ResourcePool;
 
+// Spheres quantized relative to the bounds of their cluster: 16-bit center coordinates and radius
+// plus an 8-bit material handle, so packed spheres can only use the first 256 materials of the scene.
+typedef struct PackedSphereCluster {
+    Vec3 boundsMin;
+    Vec3 boundsMax;
+    Vec3 origin;
+    Vec3 step;
+    float radiusStep;
+    uint8_t count;
+    uint16_t centers[PACKED_CLUSTER_SIZE][3];
+    uint16_t radii[PACKED_CLUSTER_SIZE];
+    uint8_t materialIds[PACKED_CLUSTER_SIZE];
+} PackedSphereCluster;
+
+typedef struct PackedSpheres {
+    PackedSphereCluster *clusters;
+    uint32_t clusterCount;
+    uint32_t clusterCapacity;
+} PackedSpheres;
+
+// Node of a light tree. Leaves hold one light, inner node i has its children at 2i + 1 and 2i + 2. The power of
+// point and spot lights is bounded in space, directional lights reach everything and are summed separately.
+typedef struct LightTreeNode {
+    Vec3 boundsMin;
+    Vec3 boundsMax;
+    float power;
+    float directionalPower;
+    LightHandle light;
+} LightTreeNode;
+
+// Spheres and lights grow inside the arena of the scene, the materials of the spheres come from the resource pool.
+// Hits are shaded with every light while there are at most lightSamples of them, above that lightSamples lights are
+// picked at random through the light tree, which has to be rebuilt by scene_build_light_tree after lights change.
 typedef struct Scene {
-    uint8_t currentSphereCount;
-    uint8_t currentLightCount;
-    Sphere spheres[MAX_SPHERE_COUNT];
-    Light lights[MAX_LIGHT_COUNT];
+    Arena *arena;
+    ResourcePool const *resources;
+    Sphere *spheres;
+    uint32_t sphereCount;
+    uint32_t sphereCapacity;
+    Light *lights;
+    uint32_t lightCount;
+    uint32_t lightCapacity;
+    LightTreeNode *lightTree;
+    uint32_t lightTreeCount;
+    uint32_t lightTreeCapacity;
+    uint32_t lightSamples;
     Camera camera;
     Vec3 ambientLight;
+    PackedSpheres const *packedSpheres;
+    uint32_t seed;
 } Scene;
 
+typedef enum RenderRequestType {
+    RRT_RENDER = 0,
+    RRT_SHUTDOWN = 1
+} RenderRequestType;
+
+typedef enum RenderStatus {
+    RS_OK = 0,
+    RS_INVALID_REQUEST = 1,
+    RS_OUT_OF_MEMORY = 2
+} RenderStatus;
+
+// Messages of the render daemon. On the socket they are packed field by field into DAEMON_REQUEST_SIZE and
+// DAEMON_RESPONSE_SIZE bytes, each field four bytes in the byte order of the host and every vector three floats, so
+// scalar and TRAYRACING_SIMD builds understand each other. A response is followed by width * height pixels of three
+// floats each, bottom row first.
+typedef struct RenderRequest {
+    uint32_t type;
+    uint32_t sceneIndex;
+    Camera camera;
+    uint32_t width;
+    uint32_t height;
+    uint32_t samplesPerPixel;
+} RenderRequest;
+
+typedef struct RenderResponse {
+    uint32_t status;
+    uint32_t width;
+    uint32_t height;
+} RenderResponse;
+
 typedef struct Frame {
     Vec3 data[FRAME_WIDTH * FRAME_HEIGHT];
 } Frame;
 
-static float font[][GLYPH_DATA_SIZE] =
+// Difference of a frame to a reference. The PSNR takes 1 as the peak value and is FLT_MAX for identical frames,
+// mismatches count the pixels with any channel further off than the tolerance of the comparison.
+typedef struct FrameComparison {
+    float maxError;
+    float psnr;
+    uint32_t mismatchCount;
+} FrameComparison;
+
+typedef enum Tonemap {
+    TM_CLAMP = 0,
+    TM_REINHARD = 1,
+    TM_ACES = 2
+} Tonemap;
+
+// Linear radiance to display-ready 8-bit sRGB: exposure, tonemapping, sRGB encoding through a table, then ordered
+// dithering and quantization. The table is indexed by the tonemapped value and holds 8.8 fixed point sRGB values.
+typedef struct ColorPipeline {
+    float scale;
+    uint8_t tonemap;
+    uint16_t dither[4][12];
+    uint16_t lut[COLOR_LUT_SIZE];
+} ColorPipeline;
+
+// Per-pixel guides of the primary hits, averaged over the samples of the pixel. Misses have zero depth and normal.
+// Stored as planes, so that filters reading them can be vectorized.
+typedef struct GBuffer {
+    float normalX[FRAME_WIDTH * FRAME_HEIGHT];
+    float normalY[FRAME_WIDTH * FRAME_HEIGHT];
+    float normalZ[FRAME_WIDTH * FRAME_HEIGHT];
+    float depth[FRAME_WIDTH * FRAME_HEIGHT];
+    float albedoR[FRAME_WIDTH * FRAME_HEIGHT];
+    float albedoG[FRAME_WIDTH * FRAME_HEIGHT];
+    float albedoB[FRAME_WIDTH * FRAME_HEIGHT];
+} GBuffer;
+
+// Planar ping-pong color buffers of frame_denoise.
+typedef struct DenoiseBuffer {
+    float color[2][3][FRAME_WIDTH * FRAME_HEIGHT];
+} DenoiseBuffer;
+
+typedef struct RenderSettings {
+    uint32_t width;
+    uint32_t height;
+    uint32_t samplesPerPixel;
+    uint8_t maxDepth;
+} RenderSettings;
+
+// An image of arbitrary resolution rendered from the given camera, rows stored bottom up like Frame.
+typedef struct RenderView {
+    Camera const *camera;
+    Vec3 *pixels;
+    uint32_t width;
+    uint32_t height;
+    uint32_t samplesPerPixel;
+    uint8_t maxDepth;
+    uint8_t checkerboard; // 0 traces every pixel, 1 and 2 only the pixels where (x + y) % 2 == checkerboard - 1.
+    GBuffer *gbuffer; // Optional, laid out with the width of the view.
+} RenderView;
+
+// Instruction set of the render kernels. CI_AUTO picks the widest one the CPU supports, or the one named by the
+// TRAYRACING_ISA environment variable (baseline, avx2 or avx512) when that is supported too.
+typedef enum CpuIsa {
+    CI_AUTO = 0,
+    CI_BASELINE = 1,
+    CI_AVX2 = 2,
+    CI_AVX512 = 3
+} CpuIsa;
+
+// A string rasterized once into a coverage mask and composited onto frames until its text, position or size changes.
+// Zero initialized it holds the empty string.
+typedef struct TextOverlay {
+    char text[OVERLAY_MAX_TEXT_LENGTH];
+    Vec2 position;
+    uint8_t size;
+    int32_t maskY; // Frame row of the first mask row.
+    int32_t x0, y0, x1, y1; // Covered pixels of the frame, [x0, x1) x [y0, y1).
+    uint8_t mask[OVERLAY_MASK_HEIGHT * FRAME_WIDTH];
+} TextOverlay;
+
+// Picks the render settings of the next frame from the measured cost of the previous ones.
+typedef struct BudgetController {
+    float targetFrameTime;
+    float costPerSample;
+    RenderSettings settings;
+} BudgetController;
+
+typedef enum FramePixelFormat {
+    FPF_RGB32F = 0,  // Three floats per pixel.
+    FPF_RGBX32F = 1  // Four floats per pixel, the last one is padding (TRAYRACING_SIMD builds).
+} FramePixelFormat;
+
+// Start of a shared frame ring, the slots follow at slotOffset, slotSize bytes apart, each holding one frame with
+// its rows bottom up. Frame n goes to slot n % slotCount. Its slot sequence is 2n - 1 while it is rendered and 2n
+// once it is complete, latest is the newest complete frame, 0 before the first one.
+typedef struct FrameRingHeader {
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t slotCount;
+    uint32_t slotOffset;
+    uint32_t slotSize;
+    uint32_t reserved;
+    uint64_t latest;
+    uint64_t slotSequence[FRAME_RING_MAX_SLOTS];
+} FrameRingHeader;
+
+// A mapping of a ring in /dev/shm, held by the renderer that writes it or a consumer that reads it.
+typedef struct FrameRing {
+    FrameRingHeader *header;
+    size_t size;
+    uint64_t sequence;
+    uint8_t owner;
+    char name[FRAME_RING_MAX_NAME];
+} FrameRing;
+
+#ifdef TRAYRACING_POSIX
+// A frame in memory shared with forked processes, only ever made by frame_create_shared. Its frame is NULL when the
+// mapping failed.
+typedef struct SharedFrame {
+    Frame *frame;
+} SharedFrame;
+
+// Called from a worker thread whenever the pixels [x0, x1) x [y0, y1) of the frame are final.
+typedef void (*RenderTileCallback)(void *userData, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
+// Owned by the caller, the scene and the frame must stay alive and the scene unchanged until renderjob_wait returns.
+typedef struct RenderJob {
+    Scene const *scene;
+    RenderView view;
+    RenderTileCallback onTileDone;
+    void *userData;
+    void (*task)(void *context, uint32_t index);
+    void *taskContext;
+    uint32_t tileCount;
+    uint32_t nextTile;
+    uint32_t finishedTiles;
+    int cancelled;
+    int done;
+    double startTime;
+    float frameTime;
+    pthread_mutex_t mutex;
+    pthread_cond_t finished;
+    struct RenderJob *next;
+} RenderJob;
+#endif
+
+TRAYRACING_UNUSED static float font[][GLYPH_DATA_SIZE] =
 {
     { 0.0f,0.0f, 0.5f,1.0f, 1.0f,0.0f, 0.75f,0.5f, 0.25f,0.5f, 0.25f,0.5f }, //A
     { 0.0f,0.0f, 0.0f,1.0f, 1.0f,0.75f, 0.0f,0.5f, 1.0f,0.25f, 0.0f,0.0f },
@@ -150,6 +467,7 @@ static float font[][GLYPH_DATA_SIZE] =
     { 1.0f,0.5f, 0.0f,0.5f, 0.0f,1.0f, 1.0f,1.0f, 1.0f,0.5f, 0.0f,0.0f }, //9
     { 0.0f,0.5f, 1.0f,0.5f, 1.0f,0.5f, 1.0f,0.5f, 1.0f,0.5f, 1.0f,0.5f }, //-
     { 0.45f,0.0f, 0.55f,0.0f, 0.55f,0.1f, 0.45f,0.1f, 0.45f,0.0f, 0.45f,0.0f }, //.
+    { 0.0f,0.0f, 1.0f,1.0f, 1.0f,1.0f, 1.0f,1.0f, 1.0f,1.0f, 1.0f,1.0f }, ///
     { 0.5f,0.465f, 0.475f,0.56f, 0.55f,0.5f, 0.45f,0.5f, 0.525f,0.56f, 0.5f,0.465f }, //*
 };
 
@@ -169,6 +487,7 @@ TRAYRACING_DECL Vec2 vec2_norm(Vec2 a);
 TRAYRACING_DECL float vec2_dist(Vec2 a, Vec2 b);
 TRAYRACING_DECL Vec2 vec2_lerp(Vec2 a, Vec2 b, float t);
 
+#ifndef TRAYRACING_SIMD
 TRAYRACING_DECL Vec3 vec3_inv(Vec3 a);
 TRAYRACING_DECL Vec3 vec3_add(Vec3 a, Vec3 b);
 TRAYRACING_DECL Vec3 vec3_sub(Vec3 a, Vec3 b);
@@ -183,29 +502,228 @@ TRAYRACING_DECL float vec3_dist(Vec3 a, Vec3 b);
 TRAYRACING_DECL Vec3 vec3_reflect(Vec3 n, Vec3 v);
 TRAYRACING_DECL Vec3 vec3_refract(Vec3 n, Vec3 i, Vec3 refrIdx);
 TRAYRACING_DECL Vec3 vec3_lerp(Vec3 a, Vec3 b, float t);
+#endif
 
 TRAYRACING_DECL Camera camera_create(Vec3 eye, Vec3 lookat, Vec3 up, float fov);
 
+TRAYRACING_DECL Light light_directional(Vec3 direction, Vec3 exitance);
+TRAYRACING_DECL Light light_point(Vec3 position, Vec3 intensity);
+TRAYRACING_DECL Light light_spot(Vec3 position, Vec3 direction, Vec3 intensity, float innerAngle, float outerAngle);
+
 TRAYRACING_DECL Material material_create(Vec3 ambient, Vec3 diffuse, Vec3 specular, float shininess, Vec3 refrIdx, Vec3 absorption, uint8_t flags);
 
-TRAYRACING_DECL ResourcePool resourcepool_create(void);
-TRAYRACING_DECL void resourcepool_add_material(ResourcePool *const pResourcePool, Material material);
+TRAYRACING_DECL Arena arena_create(void *memory, size_t capacity);
+TRAYRACING_DECL void *arena_alloc(Arena *const arena, size_t size, size_t alignment);
+TRAYRACING_DECL void arena_reset(Arena *const arena);
+
+TRAYRACING_DECL ResourcePool resourcepool_create(Arena *const arena);
+TRAYRACING_DECL MaterialHandle resourcepool_add_material(ResourcePool *const pResourcePool, Material material);
+TRAYRACING_DECL Material *resourcepool_get_material(ResourcePool const *const pResourcePool, MaterialHandle handle);
+TRAYRACING_DECL void resourcepool_clear(ResourcePool *const pResourcePool);
+
+TRAYRACING_DECL PackedSpheres packedspheres_create(PackedSphereCluster *clusters, uint32_t clusterCapacity);
+// Returns how many of the spheres were added, packing stops when the clusters run out or at the first sphere
+// whose material is past the first 256.
+TRAYRACING_DECL uint32_t packedspheres_add(PackedSpheres *const packed, Sphere const *spheres, uint32_t count);
 
 TRAYRACING_DECL void frame_save_to_file(Frame const *const frame);
+TRAYRACING_DECL int frame_save_pfm(Frame const *const frame, char const *path);
+TRAYRACING_DECL int frame_load_pfm(Frame *const frame, char const *path);
+TRAYRACING_DECL int frame_save_diff(Frame const *const frame, Frame const *const reference, char const *path);
+TRAYRACING_DECL FrameComparison frame_compare(Frame const *const frame, Frame const *const reference, float tolerance);
+TRAYRACING_DECL int frame_check(Frame const *const frame, Frame const *const reference, float tolerance, float minPsnr, char const *diffPath);
+TRAYRACING_DECL ColorPipeline colorpipeline_create(float exposure, Tonemap tonemap, uint8_t dither);
+TRAYRACING_DECL void frame_tonemap(Frame *const frame, ColorPipeline const *const pipeline);
+TRAYRACING_DECL void frame_encode_rgb8(Frame const *const frame, ColorPipeline const *const pipeline, uint8_t *const bytes);
+TRAYRACING_DECL void frame_upscale(Frame *const frame, Vec3 const *pixels, uint32_t width, uint32_t height, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
+TRAYRACING_DECL CpuIsa cpuisa_detect(void);
+TRAYRACING_DECL CpuIsa cpuisa_select(CpuIsa isa);
+TRAYRACING_DECL CpuIsa cpuisa_current(void);
+
+TRAYRACING_DECL RenderSettings rendersettings_default(void);
+
+TRAYRACING_DECL BudgetController budgetcontroller_create(float targetFrameTime);
+TRAYRACING_DECL void budgetcontroller_update(BudgetController *const controller, float frameTime);
+
+#ifdef TRAYRACING_POSIX
+TRAYRACING_DECL SharedFrame frame_create_shared(void);
+TRAYRACING_DECL void frame_destroy_shared(SharedFrame *const shared);
+
+TRAYRACING_DECL int framering_create(FrameRing *const ring, char const *name, uint32_t slotCount);
+TRAYRACING_DECL int framering_open(FrameRing *const ring, char const *name);
+TRAYRACING_DECL void framering_close(FrameRing *const ring);
+TRAYRACING_DECL Frame *framering_begin(FrameRing *const ring);
+TRAYRACING_DECL void framering_publish(FrameRing *const ring);
+TRAYRACING_DECL Frame const *framering_acquire(FrameRing const *const ring, uint64_t *const sequence);
+TRAYRACING_DECL int framering_check(FrameRing const *const ring, uint64_t sequence);
+#endif
 
 TRAYRACING_DECL void line_render(Frame *const frame, Vec2 start, Vec2 end, Vec3 color, uint8_t thickness);
 
 TRAYRACING_DECL void text_render(Frame *const frame, char const *text, Vec2 position, uint8_t size, Vec3 color);
 
-TRAYRACING_DECL Scene scene_create(Camera cam, Vec3 La);
-TRAYRACING_DECL void scene_add_sphere(Scene *const scene, Sphere sphere);
-TRAYRACING_DECL void scene_add_light(Scene *const scene, Light light);
+TRAYRACING_DECL void textoverlay_set(TextOverlay *const overlay, char const *text, Vec2 position, uint8_t size);
+TRAYRACING_DECL void textoverlay_render(Frame *const frame, TextOverlay const *const overlay, Vec3 color);
+
+TRAYRACING_DECL Scene scene_create(Arena *const arena, ResourcePool const *resources, Camera cam, Vec3 La);
+TRAYRACING_DECL SphereHandle scene_add_sphere(Scene *const scene, Sphere sphere);
+TRAYRACING_DECL LightHandle scene_add_light(Scene *const scene, Light light);
+TRAYRACING_DECL Sphere *scene_get_sphere(Scene const *const scene, SphereHandle handle);
+TRAYRACING_DECL Light *scene_get_light(Scene const *const scene, LightHandle handle);
+TRAYRACING_DECL void scene_clear(Scene *const scene);
+TRAYRACING_DECL int scene_copy(Scene *const dst, Scene const *const src);
+TRAYRACING_DECL int scene_build_light_tree(Scene *const scene);
+TRAYRACING_DECL void scene_set_packed_spheres(Scene *const scene, PackedSpheres const *packed);
 TRAYRACING_DECL float scene_render(Scene const *const scene, Frame *const frame);
+TRAYRACING_DECL float scene_render_reference(Scene const *const scene, Frame *const frame);
+TRAYRACING_DECL float scene_render_gbuffer(Scene const *const scene, Frame *const frame, GBuffer *const gbuffer, uint32_t samplesPerPixel);
+TRAYRACING_DECL void frame_denoise(Frame *const frame, GBuffer const *const gbuffer, DenoiseBuffer *const scratch);
+TRAYRACING_DECL float scene_render_checkerboard(Scene const *const scene, Frame *const frame, uint32_t frameIndex);
+TRAYRACING_DECL float scene_render_scaled(Scene const *const scene, RenderSettings const *const settings, Vec3 *const scratch, Frame *const frame);
+TRAYRACING_DECL float scene_render_views(Scene const *const scene, RenderView const *views, uint32_t viewCount);
+TRAYRACING_DECL float scene_render_batch(Scene const *const scene, Camera const *cameras, Frame *const frames, uint32_t count);
+TRAYRACING_DECL int scene_render_to_file(Scene const *const scene, RenderSettings const *const settings, Vec3 *const scratch, uint32_t bandHeight, char const *path);
+
+#ifdef TRAYRACING_POSIX
+// Renders the shared frame in forked workers.
+TRAYRACING_DECL float scene_render_multiprocess(Scene const *const scene, SharedFrame const *const shared, uint32_t workerCount);
+
+// Serves connections on workerCount threads, the tiles of every requested frame are rendered on the worker pool.
+TRAYRACING_DECL int renderdaemon_run(char const *socketPath, Scene const *scenes, uint32_t sceneCount, uint32_t workerCount);
+TRAYRACING_DECL int renderdaemon_request(char const *socketPath, RenderRequest const *requests, Vec3 *const *pixels, uint32_t count);
+TRAYRACING_DECL int renderdaemon_stop(char const *socketPath);
+
+TRAYRACING_DECL void scene_render_async(RenderJob *const job, Scene const *const scene, Frame *const frame, RenderTileCallback onTileDone, void *userData);
+TRAYRACING_DECL void scene_render_view_async(RenderJob *const job, Scene const *const scene, RenderView const *const view, RenderTileCallback onTileDone, void *userData);
+TRAYRACING_DECL int renderjob_poll(RenderJob *const job);
+TRAYRACING_DECL float renderjob_wait(RenderJob *const job);
+TRAYRACING_DECL void renderjob_cancel(RenderJob *const job);
+#endif
 
 #ifdef __cplusplus
 }
 #endif
 
+#ifdef TRAYRACING_SIMD
+TRAYRACING_VEC_INLINE Vec3 vec3_from_m128(__m128 m)
+{
+    Vec3 result;
+    result.m = m;
+    return result;
+}
+
+// x + y + z broadcast to the first three lanes.
+TRAYRACING_VEC_INLINE __m128 vec3_dot_m128(__m128 a, __m128 b)
+{
+    __m128 const m = _mm_mul_ps(a, b);
+    __m128 const yzx = _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 const zxy = _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 1, 0, 2));
+    return _mm_add_ps(_mm_add_ps(m, yzx), zxy);
+}
+
+TRAYRACING_VEC_INLINE Vec3 vec3_inv(Vec3 a)
+{
+    return vec3_from_m128(_mm_sub_ps(_mm_setzero_ps(), a.m));
+}
+
+TRAYRACING_VEC_INLINE Vec3 vec3_add(Vec3 a, Vec3 b)
+{
+    return vec3_from_m128(_mm_add_ps(a.m, b.m));
+}
+
+TRAYRACING_VEC_INLINE Vec3 vec3_sub(Vec3 a, Vec3 b)
+{
+    return vec3_from_m128(_mm_sub_ps(a.m, b.m));
+}
+
+TRAYRACING_VEC_INLINE Vec3 vec3_scale(float f, Vec3 a)
+{
+    return vec3_from_m128(_mm_mul_ps(_mm_set1_ps(f), a.m));
+}
+
+TRAYRACING_VEC_INLINE Vec3 vec3_mul(Vec3 a, Vec3 b)
+{
+    return vec3_from_m128(_mm_mul_ps(a.m, b.m));
+}
+
+TRAYRACING_VEC_INLINE float vec3_dot(Vec3 a, Vec3 b)
+{
+    return _mm_cvtss_f32(vec3_dot_m128(a.m, b.m));
+}
+
+TRAYRACING_VEC_INLINE Vec3 vec3_cross(Vec3 a, Vec3 b)
+{
+    __m128 const aYzx = _mm_shuffle_ps(a.m, a.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 const bYzx = _mm_shuffle_ps(b.m, b.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 const c = _mm_sub_ps(_mm_mul_ps(a.m, bYzx), _mm_mul_ps(aYzx, b.m));
+    return vec3_from_m128(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+
+TRAYRACING_VEC_INLINE float vec3_length_sqr(Vec3 a)
+{
+    return vec3_dot(a, a);
+}
+
+TRAYRACING_VEC_INLINE float vec3_length(Vec3 a)
+{
+    return _mm_cvtss_f32(_mm_sqrt_ss(vec3_dot_m128(a.m, a.m)));
+}
+
+// Approximate reciprocal square root refined by one Newton-Raphson step, about 22 bits exact.
+TRAYRACING_VEC_INLINE Vec3 vec3_norm(Vec3 a)
+{
+    __m128 const lengthSqr = vec3_dot_m128(a.m, a.m);
+    __m128 const estimate = _mm_rsqrt_ps(lengthSqr);
+    __m128 const halfLengthSqr = _mm_mul_ps(_mm_set1_ps(0.5f), lengthSqr);
+    __m128 const refined = _mm_mul_ps(estimate,
+        _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(halfLengthSqr, _mm_mul_ps(estimate, estimate))));
+    __m128 const valid = _mm_cmpgt_ps(lengthSqr, _mm_set1_ps(PRECISION * PRECISION));
+
+    return vec3_from_m128(_mm_and_ps(valid, _mm_mul_ps(a.m, refined)));
+}
+
+TRAYRACING_VEC_INLINE float vec3_dist(Vec3 a, Vec3 b)
+{
+    return vec3_length(vec3_sub(b, a));
+}
+
+TRAYRACING_VEC_INLINE Vec3 vec3_reflect(Vec3 n, Vec3 v)
+{
+    return vec3_from_m128(_mm_sub_ps(v.m, _mm_mul_ps(_mm_add_ps(vec3_dot_m128(n.m, v.m), vec3_dot_m128(n.m, v.m)), n.m)));
+}
+
+// Same per-channel refraction as the scalar backend, the three channels computed side by side.
+TRAYRACING_VEC_INLINE Vec3 vec3_refract(Vec3 n, Vec3 i, Vec3 refrIdx)
+{
+    __m128 cosa = vec3_dot_m128(n.m, i.m);
+    __m128 invRefrIdx = _mm_div_ps(_mm_set1_ps(1.0f), refrIdx.m);
+    if (_mm_cvtss_f32(cosa) > 0.0f) {
+        cosa = _mm_sub_ps(_mm_setzero_ps(), cosa);
+        invRefrIdx = refrIdx.m;
+    }
+
+    __m128 const num = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(cosa, cosa));
+    __m128 const disc = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(num, _mm_mul_ps(invRefrIdx, invRefrIdx)));
+
+    if ((_mm_movemask_ps(_mm_cmplt_ps(disc, _mm_setzero_ps())) & 7) != 0) {
+        return vec3_reflect(n, i);
+    }
+
+    // Sum over the channels of invRefrIdx * i + (cosa * invRefrIdx - sqrt(disc)) * n.
+    __m128 const ones = _mm_set_ps(0.0f, 1.0f, 1.0f, 1.0f);
+    __m128 const iScale = vec3_dot_m128(invRefrIdx, ones);
+    __m128 const nScale = vec3_dot_m128(_mm_sub_ps(_mm_mul_ps(cosa, invRefrIdx), _mm_sqrt_ps(_mm_max_ps(disc, _mm_setzero_ps()))), ones);
+
+    return vec3_from_m128(_mm_add_ps(_mm_mul_ps(iScale, i.m), _mm_mul_ps(nScale, n.m)));
+}
+
+TRAYRACING_VEC_INLINE Vec3 vec3_lerp(Vec3 a, Vec3 b, float t)
+{
+    return vec3_from_m128(_mm_add_ps(a.m, _mm_mul_ps(_mm_set1_ps(t), _mm_sub_ps(b.m, a.m))));
+}
+#endif
+
 #endif // TRAYRACING_H
 
 #ifdef TRAYRACING_IMPLEMENTATION
@@ -214,9 +732,68 @@ TRAYRACING_DECL float scene_render(Scene const *const scene, Frame *const frame)
 #include <math.h>
 #include <time.h>
 #include <stdlib.h>
+#include <float.h>
+#include <stddef.h>
+#include <string.h>
+
+// Render kernels get extra AVX2 and AVX-512 variants where the compiler can target them per function. GCC would
+// contract their multiplies and adds into FMA, which the baseline cannot, so contraction is turned off to keep the
+// variants rounding like the baseline.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define TRAYRACING_DISPATCH
+#include <immintrin.h>
+#if defined(__clang__)
+#define TRAYRACING_TARGET_AVX2 __attribute__((target("avx2")))
+#define TRAYRACING_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define TRAYRACING_TARGET_AVX2 __attribute__((target("avx2"), optimize("fp-contract=off")))
+#define TRAYRACING_TARGET_AVX512 __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#endif
+#endif
 
-#ifndef PRECISION
-#define PRECISION 1e-4f
+#if defined(__GNUC__) || defined(__clang__)
+#define TRAYRACING_KERNEL_INLINE static inline __attribute__((always_inline))
+#else
+#define TRAYRACING_KERNEL_INLINE static inline
+#endif
+
+#if defined(__cplusplus)
+#define TRAYRACING_THREAD_LOCAL thread_local
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define TRAYRACING_THREAD_LOCAL _Thread_local
+#else
+#define TRAYRACING_THREAD_LOCAL __thread
+#endif
+
+#ifdef TRAYRACING_POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifndef DENOISE_SIGMA_COLOR
+#define DENOISE_SIGMA_COLOR 0.5f
+#endif
+
+#ifndef DENOISE_SIGMA_NORMAL
+#define DENOISE_SIGMA_NORMAL 0.1f
+#endif
+
+#ifndef DENOISE_SIGMA_DEPTH
+#define DENOISE_SIGMA_DEPTH 0.02f
+#endif
+
+#ifndef DENOISE_SIGMA_ALBEDO
+#define DENOISE_SIGMA_ALBEDO 0.1f
+#endif
+
+#ifndef MIN_RENDER_SCALE
+#define MIN_RENDER_SCALE 0.25f
 #endif
 
 #ifndef M_PIf
@@ -241,9 +818,20 @@ typedef struct Hit {
     Material const *material;
 } Hit;
 
+// The hot loops, one table per instruction set. Variants do the same operations in the same order, so they agree bit
+// for bit unless -ffast-math lets the compiler reassociate them differently.
+typedef struct RenderKernels {
+    float (*spheresNearest)(Sphere const *spheres, uint32_t count, Ray const *ray, int32_t *index);
+    void (*denoiseBand)(void *context, uint32_t band);
+    void (*convertRgb8)(Vec3 const *pixels, uint8_t *bytes, uint32_t count);
+    void (*encodeRgb8)(ColorPipeline const *pipeline, Vec3 const *pixels, uint8_t *bytes, uint32_t count, uint32_t y);
+} RenderKernels;
+
+static RenderKernels const *render_kernels(void);
+
 static inline float rand_float(float lowerBound, float upperBound)
 {
-    return (upperBound - lowerBound) * ((float)rand() / RAND_MAX) + lowerBound;
+    return (upperBound - lowerBound) * ((float)rand() / (float)RAND_MAX) + lowerBound;
 }
 
 static inline int rand_int(int lowerBound, int upperBound)
@@ -251,6 +839,30 @@ static inline int rand_int(int lowerBound, int upperBound)
     return rand() % (upperBound - lowerBound + 1) + lowerBound;
 }
 
+static inline uint32_t hash_u32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+
+    return x;
+}
+
+// Counter based generator, so every pixel gets the same samples no matter which thread or process renders it.
+static inline float sampler_next(uint32_t *const state)
+{
+    *state = hash_u32(*state + 0x9e3779b9U);
+
+    return (float)(*state >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline float sampler_range(uint32_t *const state, float lowerBound, float upperBound)
+{
+    return (upperBound - lowerBound) * sampler_next(state) + lowerBound;
+}
+
 static inline float clamp(float v, float lowerBound, float upperBound)
 {
     return v < lowerBound ? lowerBound : v > upperBound ? upperBound : v;
@@ -393,6 +1005,7 @@ static inline Vec3 vec3_negative_unit_z(void)
     return LITERAL(Vec3){.x = 0.0f, .y = 0.0f, .z = -1.0f};
 }
 
+#ifndef TRAYRACING_SIMD
 Vec3 vec3_inv(Vec3 a)
 {
     return LITERAL(Vec3){.x = -a.x, .y = -a.y, .z = -a.z};
@@ -487,11 +1100,14 @@ Vec3 vec3_refract(Vec3 n, Vec3 i, Vec3 refrIdx)
                 vec3_add(vec3_scale(vec3_invRefrIdxZ, i), vec3_scale(cosa * vec3_invRefrIdxZ - sqrtf(discZ), n)));
 }
 
+// Same formula as the SSE backend, so that both give the same bits.
 Vec3 vec3_lerp(Vec3 a, Vec3 b, float t)
 {
-    return vec3_add(vec3_scale(1.0f - t, a), vec3_scale(t, b));
+    return vec3_add(a, vec3_scale(t, vec3_sub(b, a)));
 }
 
+#endif
+
 Camera camera_create(Vec3 eye, Vec3 lookat, Vec3 up, float fov)
 {
     Camera camera;
@@ -508,10 +1124,25 @@ Camera camera_create(Vec3 eye, Vec3 lookat, Vec3 up, float fov)
 
 static Ray camera_get_ray(Camera const *const camera, uint32_t x, uint32_t y, uint32_t screenWidth, uint32_t screenHeight, float xOffset, float yOffset)
 {
-    Vec3 const dir = vec3_sub(vec3_add(vec3_add(camera->lookat, vec3_scale((2.0f * (x + xOffset) / screenWidth - 1), camera->right)), vec3_scale((2.0f * (y + yOffset) / screenHeight - 1), camera->up)), camera->eye);
+    Vec3 const dir = vec3_sub(vec3_add(vec3_add(camera->lookat, vec3_scale((2.0f * ((float)x + xOffset) / (float)screenWidth - 1), camera->right)), vec3_scale((2.0f * ((float)y + yOffset) / (float)screenHeight - 1), camera->up)), camera->eye);
     return LITERAL(Ray){camera->eye, vec3_norm(dir)};
 }
 
+Light light_directional(Vec3 direction, Vec3 exitance)
+{
+    return LITERAL(Light){vec3_norm(direction), exitance, vec3_zero(), 1.0f, 1.0f, LT_DIRECTIONAL};
+}
+
+Light light_point(Vec3 position, Vec3 intensity)
+{
+    return LITERAL(Light){vec3_zero(), intensity, position, 1.0f, 1.0f, LT_POINT};
+}
+
+Light light_spot(Vec3 position, Vec3 direction, Vec3 intensity, float innerAngle, float outerAngle)
+{
+    return LITERAL(Light){vec3_norm(direction), intensity, position, cosf(innerAngle), cosf(outerAngle), LT_SPOT};
+}
+
 Material material_create(Vec3 ambient, Vec3 diffuse, Vec3 specular, float shininess, Vec3 refrIdx, Vec3 absorption, uint8_t flags)
 {
     Material material;
@@ -567,7 +1198,7 @@ static Vec3 material_shade_fresnel(Material const *const material, Vec3 normal,
     return vec3_add(material->minReflectance, vec3_scale(powf(1.0f - cosa, 5), vec3_sub(vec3_one(), material->minReflectance)));
 }
 
-static Material material_emerald(void)
+TRAYRACING_UNUSED static Material material_emerald(void)
 {
     Vec3 const diffuse = {.r = 0.07568f, .g = 0.61424f, .b = 0.07568f};
     Vec3 const specular = {.r = 0.633f, .g = 0.727811f, .b = 0.633f};
@@ -577,7 +1208,7 @@ static Material material_emerald(void)
     return material_create(ambient, diffuse, specular, shininess, vec3_zero(), vec3_zero(), MT_ROUGH);
 }
 
-static Material material_gold(void)
+TRAYRACING_UNUSED static Material material_gold(void)
 {
     Vec3 eta = {.r = 0.17f, .g = 0.35f, .b = 1.5f};
     Vec3 kappa = {.r = 3.1f, .g = 2.7f, .b = 1.9f};
@@ -585,7 +1216,7 @@ static Material material_gold(void)
     return material_create(vec3_zero(), vec3_zero(), vec3_zero(), 0.0f, eta, kappa, MT_REFLECTIVE);
 }
 
-static Material material_glass(void)
+TRAYRACING_UNUSED static Material material_glass(void)
 {
     Vec3 eta = {.r = 1.5f, .g = 1.5f, .b = 1.5f};
     Vec3 kappa = {.r = 0.0f, .g = 0.0f, .b = 0.0f};
@@ -593,7 +1224,7 @@ static Material material_glass(void)
     return material_create(vec3_zero(), vec3_zero(), vec3_zero(), 0.0f, eta, kappa, MT_REFLECTIVE | MT_REFRACTIVE);
 }
 
-static Material material_silver(void)
+TRAYRACING_UNUSED static Material material_silver(void)
 {
     Vec3 eta = {.r = 0.14f, .g = 0.16f, .b = 0.13f};
     Vec3 kappa = {.r = 4.1f, .g = 2.3f, .b = 3.1f};
@@ -601,7 +1232,7 @@ static Material material_silver(void)
     return material_create(vec3_zero(), vec3_zero(), vec3_zero(), 0.0f, eta, kappa, MT_REFLECTIVE);
 }
 
-static Material material_diamond(void)
+TRAYRACING_UNUSED static Material material_diamond(void)
 {
     Vec3 eta = {.r = 2.4f, .g = 2.4f, .b = 2.4f};
     Vec3 kappa = {.r = 0.0f, .g = 0.0f, .b = 0.0f};
@@ -609,7 +1240,7 @@ static Material material_diamond(void)
     return material_create(vec3_zero(), vec3_zero(), vec3_zero(), 0.0f, eta, kappa, MT_REFLECTIVE | MT_REFRACTIVE);
 }
 
-static Material material_copper(void)
+TRAYRACING_UNUSED static Material material_copper(void)
 {
     Vec3 eta = {.r = 0.2f, .g = 1.1f, .b = 1.2f};
     Vec3 kappa = {.r = 3.6f, .g = 2.6f, .b = 2.3f};
@@ -637,7 +1268,7 @@ static float sphere_intersect_t(Sphere const *const sphere, Ray const *const ray
     return t > 0.0f ? t : -1.0f;
 }
 
-static Hit sphere_intersect(Sphere const *const sphere, Ray const *const ray, float t)
+static Hit sphere_intersect(Sphere const *const sphere, Material const *materials, Ray const *const ray, float t)
 {
     Hit hit;
 
@@ -647,296 +1278,3240 @@ static Hit sphere_intersect(Sphere const *const sphere, Ray const *const ray, fl
     if (vec3_dot(ray->direction, hit.normal) > 0.0f) {
         hit.normal = vec3_inv(hit.normal);
     }
-    hit.material = sphere->material;
+    hit.material = &(materials[sphere->material]);
 
     return hit;
 }
 
-ResourcePool resourcepool_create(void)
+static inline Sphere packedsphere_decode(PackedSphereCluster const *const cluster, uint8_t i)
 {
-    ResourcePool resourcePool;
+    Sphere sphere;
 
-    resourcePool.currentMaterialCount = 0;
+    sphere.center.x = cluster->origin.x + cluster->step.x * cluster->centers[i][0];
+    sphere.center.y = cluster->origin.y + cluster->step.y * cluster->centers[i][1];
+    sphere.center.z = cluster->origin.z + cluster->step.z * cluster->centers[i][2];
+    sphere.radius = cluster->radiusStep * cluster->radii[i];
+    sphere.material = cluster->materialIds[i];
 
-    return resourcePool;
+    return sphere;
 }
 
-void resourcepool_add_material(ResourcePool *const pResourcePool, Material material)
+static inline float packedsphere_intersect_t(PackedSphereCluster const *const cluster, uint8_t i, Ray const *const ray)
 {
-    if (pResourcePool->currentMaterialCount < MAX_MATERIAL_COUNT) {
-        pResourcePool->materials[pResourcePool->currentMaterialCount++] = material;
-    }
+    Sphere const sphere = packedsphere_decode(cluster, i);
+
+    return sphere_intersect_t(&sphere, ray);
 }
 
-void frame_save_to_file(Frame const *const frame)
+static inline Vec3 ray_inv_direction(Ray const *const ray)
 {
-    // Assemble output file name.
-    static uint32_t counter = 0;
+    // Keep the reciprocals finite, -ffast-math assumes there are no infinities.
+    Vec3 invDir;
 
-    if (counter > 999)
+    for (uint8_t i = 0; i < 3; ++i)
     {
-        printf("No more screenshots will be written in this session!\n");
-        return;
+        float const d = ray->direction.v[i];
+        invDir.v[i] = 1.0f / (fabsf(d) > 1e-8f ? d : copysignf(1e-8f, d));
     }
 
-    char output_path[256];
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
+    return invDir;
+}
 
-    snprintf(output_path, sizeof(output_path), SCREENSHOTS_FOLDER"screenshot_%d%02d%02dT%02d%02d%02d_%03d.ppm",
-            t->tm_year + 1900,
-            t->tm_mon + 1,
-            t->tm_mday,
-            t->tm_hour,
-            t->tm_min,
-            t->tm_sec,
-            counter++);
+static inline int ray_hits_box(Ray const *const ray, Vec3 invDir, Vec3 boxMin, Vec3 boxMax, float tMax)
+{
+    float tNear = 0.0f;
+    float tFar = tMax;
 
-    // Open file.
-    FILE* file = fopen(output_path, "wb");
+    for (uint8_t i = 0; i < 3; ++i)
+    {
+        float t0 = (boxMin.v[i] - ray->origin.v[i]) * invDir.v[i];
+        float t1 = (boxMax.v[i] - ray->origin.v[i]) * invDir.v[i];
+        if (t0 > t1) {
+            float const tmp = t0;
+            t0 = t1;
+            t1 = tmp;
+        }
+        tNear = t0 > tNear ? t0 : tNear;
+        tFar = t1 < tFar ? t1 : tFar;
+    }
 
-    // Write meta data into file.
-    fprintf(file, "P6\n%d %d\n255\n", FRAME_WIDTH, FRAME_HEIGHT);
+    return tNear <= tFar;
+}
 
-    // Write pixel data into file, from the top left pixel to the bottom right pixel.
-    for (int32_t y = FRAME_HEIGHT - 1; y >= 0; --y)
-    {
-        for (int32_t x = 0; x < FRAME_WIDTH; ++x)
-        {
-            Vec3 const *const pixel = &(frame->data[y * FRAME_WIDTH + x]);
+PackedSpheres packedspheres_create(PackedSphereCluster *clusters, uint32_t clusterCapacity)
+{
+    PackedSpheres packed;
 
-            uint8_t const r = clamp(pixel->r, 0.0f, 1.0f) * 255;
-            uint8_t const g = clamp(pixel->g, 0.0f, 1.0f) * 255;
-            uint8_t const b = clamp(pixel->b, 0.0f, 1.0f) * 255;
+    packed.clusters = clusters;
+    packed.clusterCount = 0;
+    packed.clusterCapacity = clusterCapacity;
 
-            uint8_t data[3] = { r, g, b };
+    return packed;
+}
 
-            fwrite(data, 1, sizeof(data), file);
-        }
+static inline uint16_t quantize_u16(float v, float origin, float step)
+{
+    if (step <= 0.0f) {
+        return 0;
     }
+    float const q = (v - origin) / step + 0.5f;
 
-    // Close file.
-    fclose(file);
-
-    printf("Screenshot is saved as \'%s\'.\n", output_path);
+    return q <= 0.0f ? 0 : q >= 65535.0f ? UINT16_MAX : (uint16_t)q;
 }
 
-void line_render(Frame *const frame, Vec2 start, Vec2 end, Vec3 color, uint8_t thickness)
+static void packedspheres_add_cluster(PackedSpheres *const packed, Sphere const *spheres, uint8_t count)
 {
-    Vec2 const direction = vec2_norm(vec2_sub(end, start));
-    Vec2 const perpendicular = LITERAL(Vec2){.x = -direction.y, .y = direction.x};
+    PackedSphereCluster *const cluster = &(packed->clusters[packed->clusterCount++]);
 
-    for (float t = 0.0f, delta = 0.125f / vec2_dist(start, end), tend = 1.0f + delta; t < tend; t += delta)
-    {
-        Vec2 const p = vec2_lerp(start, end, t);
-        frame->data[(int)(p.y + 0.5f) * FRAME_WIDTH + (int)(p.x + 0.5f)] = color;
+    Vec3 centerMin = spheres[0].center;
+    Vec3 centerMax = spheres[0].center;
+    float radiusMax = spheres[0].radius;
 
-        for (uint8_t i = 2; i <= thickness; ++i)
+    for (uint8_t i = 1; i < count; ++i)
+    {
+        for (uint8_t a = 0; a < 3; ++a)
         {
-            Vec2 p2 = vec2_scale(i / 2, perpendicular);
-
-            if (i % 2 == 0) {
-                p2 = vec2_add(p, p2);
-            } else {
-                p2 = vec2_sub(p, p2);
-            }
-
-            frame->data[(int)(p2.y + 0.5f) * FRAME_WIDTH + (int)(p2.x + 0.5f)] = color;
+            centerMin.v[a] = fminf(centerMin.v[a], spheres[i].center.v[a]);
+            centerMax.v[a] = fmaxf(centerMax.v[a], spheres[i].center.v[a]);
         }
+        radiusMax = fmaxf(radiusMax, spheres[i].radius);
     }
-}
 
-static inline char glyph_character_map(char c)
-{
-    if (c >= '0' && c <= '9') {
-        return c - '0' + ('Z' - 'A' + 1);
-    }
-    if (c == '-') {
-        return 36;
-    }
-    if (c == '.') {
-        return 37;
-    }
-    if (c == ' ') {
-        return -1;
-    }
+    cluster->count = count;
+    cluster->origin = centerMin;
+    cluster->step = vec3_scale(1.0f / UINT16_MAX, vec3_sub(centerMax, centerMin));
+    cluster->radiusStep = radiusMax / UINT16_MAX;
 
-    // Convert character to lower case.
-    c |= 0x20;
+    // Bounds are taken from the decoded spheres so that quantization can never move a sphere outside of them.
+    cluster->boundsMin = vec3_scale(FLT_MAX, vec3_one());
+    cluster->boundsMax = vec3_scale(-FLT_MAX, vec3_one());
 
-    if (c >= 'a' && c <= 'z') {
-        return c - 'a';
-    }
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        Sphere const *const sphere = &spheres[i];
+
+        for (uint8_t a = 0; a < 3; ++a)
+        {
+            cluster->centers[i][a] = quantize_u16(sphere->center.v[a], cluster->origin.v[a], cluster->step.v[a]);
+        }
+        cluster->radii[i] = quantize_u16(sphere->radius, 0.0f, cluster->radiusStep);
+        cluster->materialIds[i] = (uint8_t)sphere->material;
 
-    return 38;
+        Sphere const decoded = packedsphere_decode(cluster, i);
+        for (uint8_t a = 0; a < 3; ++a)
+        {
+            cluster->boundsMin.v[a] = fminf(cluster->boundsMin.v[a], decoded.center.v[a] - decoded.radius);
+            cluster->boundsMax.v[a] = fmaxf(cluster->boundsMax.v[a], decoded.center.v[a] + decoded.radius);
+        }
+    }
 }
 
-void text_render(Frame *const frame, char const *text, Vec2 position, uint8_t size, Vec3 color)
+uint32_t packedspheres_add(PackedSpheres *const packed, Sphere const *spheres, uint32_t count)
 {
-    uint8_t const GLYPH_POINT_COUNT = GLYPH_DATA_SIZE / 2;
-    float const step = 1.5f * size;
+    uint32_t added = 0;
 
-    char c;
-    while ((c = *(text++)))
+    // Spheres are clustered in the given order, so spatially sorted input gives tighter clusters.
+    while (added < count && packed->clusterCount < packed->clusterCapacity)
     {
-        char const index = glyph_character_map(c);
-
-        if (index != -1) {
-            float* glyph_normal_coords = font[index];
-            Vec2 glyph_pixel_coords[GLYPH_POINT_COUNT];
+        uint32_t const remaining = count - added;
+        uint8_t clusterSize = remaining < PACKED_CLUSTER_SIZE ? (uint8_t)remaining : PACKED_CLUSTER_SIZE;
 
-            for (size_t i = 0; i < GLYPH_DATA_SIZE; i += 2)
-            {
-                glyph_pixel_coords[i/2] =
-                    vec2_add(vec2_scale(size, LITERAL(Vec2){.x = glyph_normal_coords[i], .y = glyph_normal_coords[i+1]}), position);
-            }
-
-            for (size_t i = 0, n = GLYPH_POINT_COUNT - 1; i < n; ++i)
-            {
-                line_render(frame, glyph_pixel_coords[i], glyph_pixel_coords[i+1], color, 1);
+        // Material ids are 8-bit, a wider handle would wrap onto another material.
+        for (uint8_t i = 0; i < clusterSize; ++i)
+        {
+            if (spheres[added + i].material > UINT8_MAX) {
+                clusterSize = i;
+                break;
             }
         }
+        if (clusterSize == 0) {
+            break;
+        }
 
-        position = vec2_add(position, LITERAL(Vec2){.x = step, .y = 0.0f});
+        packedspheres_add_cluster(packed, &spheres[added], clusterSize);
+        added += clusterSize;
     }
+
+    return added;
 }
 
-Scene scene_create(Camera cam, Vec3 La)
+Arena arena_create(void *memory, size_t capacity)
 {
-    Scene scene;
+    Arena arena;
 
-    scene.currentSphereCount = 0;
-    scene.currentLightCount = 0;
-    scene.camera = cam;
-    scene.ambientLight = La;
+    arena.memory = (uint8_t *)memory;
+    arena.capacity = capacity;
+    arena.used = 0;
 
-    return scene;
+    return arena;
 }
 
-void scene_add_sphere(Scene *const scene, Sphere sphere)
+void *arena_alloc(Arena *const arena, size_t size, size_t alignment)
 {
-    if (scene->currentSphereCount < MAX_SPHERE_COUNT) {
-        scene->spheres[scene->currentSphereCount++] = sphere;
+    uintptr_t const address = (uintptr_t)(arena->memory + arena->used);
+    size_t const padding = (alignment - address % alignment) % alignment;
+
+    if (size > arena->capacity - arena->used || padding > arena->capacity - arena->used - size) {
+        return NULL;
     }
+
+    arena->used += padding + size;
+
+    return arena->memory + arena->used - size;
 }
 
-void scene_add_light(Scene *const scene, Light light)
+void arena_reset(Arena *const arena)
 {
-    if (scene->currentLightCount < MAX_LIGHT_COUNT) {
-        scene->lights[scene->currentLightCount++] = light;
-    }
+    arena->used = 0;
 }
 
-static Hit scene_raycast(Scene const *const scene, Ray const *const ray)
+// Returns storage for at least count + 1 items. A full array is extended in place when it was the last allocation
+// of the arena, otherwise it moves to a block twice as large and the old one stays unused until the arena is reset.
+static void *arena_grow(Arena *const arena, void *items, uint32_t count, uint32_t *capacity, size_t itemSize)
 {
-    float bestT = -1.0f;
-    int bestIdx = -1;
-
-    Sphere const *const spheres = scene->spheres;
+    if (count < *capacity) {
+        return items;
+    }
 
-    for (uint8_t i = 0, sphereCount = scene->currentSphereCount; i < sphereCount; ++i)
-    {
-        float const t = sphere_intersect_t(&spheres[i], ray);
+    uint32_t const newCapacity = *capacity == 0 ? ARENA_INITIAL_CAPACITY : 2 * *capacity;
+    size_t const extra = (size_t)(newCapacity - *capacity) * itemSize;
 
-        if (t > 0.0f && (bestT < 0.0f || t < bestT))
-        {
-            bestT = t;
-            bestIdx = i;
-        }
+    if (items != NULL && (uint8_t *)items + (size_t)*capacity * itemSize == arena->memory + arena->used &&
+        extra <= arena->capacity - arena->used) {
+        arena->used += extra;
+        *capacity = newCapacity;
+        return items;
     }
 
-    if (bestT < 0.0f)
-    {
-        Hit hit;
-        hit.t = bestT;
-
-        return hit;
+    void *const grown = arena_alloc(arena, (size_t)newCapacity * itemSize, ARENA_ALIGNMENT);
+    if (grown == NULL) {
+        return NULL;
+    }
+    if (count > 0) {
+        memcpy(grown, items, (size_t)count * itemSize);
     }
+    *capacity = newCapacity;
 
-    return sphere_intersect(&spheres[bestIdx], ray, bestT);
+    return grown;
 }
 
-static Vec3 scene_raytrace(Scene const *const scene, Ray const *const ray, uint8_t depth)
+ResourcePool resourcepool_create(Arena *const arena)
 {
-    if (depth > 5)
+    ResourcePool resourcePool;
+
+    resourcePool.arena = arena;
+    resourcePool.materials = NULL;
+    resourcePool.materialCount = 0;
+    resourcePool.materialCapacity = 0;
+
+    return resourcePool;
+}
+
+MaterialHandle resourcepool_add_material(ResourcePool *const pResourcePool, Material material)
+{
+    Material *const materials = (Material *)arena_grow(pResourcePool->arena, pResourcePool->materials,
+        pResourcePool->materialCount, &(pResourcePool->materialCapacity), sizeof(Material));
+    if (materials == NULL) {
+        return INVALID_HANDLE;
+    }
+
+    pResourcePool->materials = materials;
+    pResourcePool->materials[pResourcePool->materialCount] = material;
+
+    return pResourcePool->materialCount++;
+}
+
+Material *resourcepool_get_material(ResourcePool const *const pResourcePool, MaterialHandle handle)
+{
+    return handle < pResourcePool->materialCount ? &(pResourcePool->materials[handle]) : NULL;
+}
+
+// Keeps the storage, so refilling the pool does not touch the arena until it outgrows its previous size.
+void resourcepool_clear(ResourcePool *const pResourcePool)
+{
+    pResourcePool->materialCount = 0;
+}
+
+void frame_save_to_file(Frame const *const frame)
+{
+    // Assemble output file name.
+    static uint32_t counter = 0;
+
+    if (counter > 999)
     {
-        return scene->ambientLight;
+        printf("No more screenshots will be written in this session!\n");
+        return;
     }
 
-    Hit const hit = scene_raycast(scene, ray);
-    if (hit.t < 0)
+    char output_path[256];
+    time_t now = time(NULL);
+    struct tm *t = localtime(&now);
+
+    snprintf(output_path, sizeof(output_path), SCREENSHOTS_FOLDER"screenshot_%d%02d%02dT%02d%02d%02d_%03d.ppm",
+            t->tm_year + 1900,
+            t->tm_mon + 1,
+            t->tm_mday,
+            t->tm_hour,
+            t->tm_min,
+            t->tm_sec,
+            counter++);
+
+    // Open file.
+    FILE* file = fopen(output_path, "wb");
+
+    // Write meta data into file.
+    fprintf(file, "P6\n%d %d\n255\n", FRAME_WIDTH, FRAME_HEIGHT);
+
+    // Write pixel data into file, from the top left pixel to the bottom right pixel.
+    uint8_t row[3 * FRAME_WIDTH];
+    for (int32_t y = FRAME_HEIGHT - 1; y >= 0; --y)
     {
-        return scene->ambientLight;
+        render_kernels()->convertRgb8(&(frame->data[y * FRAME_WIDTH]), row, FRAME_WIDTH);
+        fwrite(row, 1, sizeof(row), file);
     }
 
-    Vec3 outRadiance = vec3_zero();
-    Vec3 const viewDir = vec3_inv(ray->direction);
+    // Close file.
+    fclose(file);
 
-    if (hit.material->flags & MT_ROUGH)
+    printf("Screenshot is saved as \'%s\'.\n", output_path);
+}
+
+// Golden frames are stored as little-endian PFM, full precision, bottom row first like the frame itself.
+int frame_save_pfm(Frame const *const frame, char const *path)
+{
+    FILE *const file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    fprintf(file, "PF\n%d %d\n-1.0\n", FRAME_WIDTH, FRAME_HEIGHT);
+
+    float row[3 * FRAME_WIDTH];
+    for (uint32_t y = 0; y < FRAME_HEIGHT; ++y)
     {
-        outRadiance = vec3_add(outRadiance, vec3_mul(hit.material->ambient, scene->ambientLight));
-        for (uint8_t i = 0; i < scene->currentLightCount; ++i)
+        for (uint32_t x = 0; x < FRAME_WIDTH; ++x)
         {
-            Vec3 const toLight = vec3_norm(vec3_inv(scene->lights[i].direction));
-            Ray const shadowRay = {vec3_add(hit.position, vec3_scale(PRECISION, hit.normal)), toLight};
-            Hit const shadowHit = scene_raycast(scene, &shadowRay);
-            if (shadowHit.t < 0)
-            {
-                outRadiance = vec3_add(outRadiance, material_shade_phong_blinn(hit.material, hit.normal, viewDir, toLight, scene->lights[i].exitance));
-            }
+            Vec3 const pixel = frame->data[y * FRAME_WIDTH + x];
+            row[3 * x + 0] = pixel.r;
+            row[3 * x + 1] = pixel.g;
+            row[3 * x + 2] = pixel.b;
         }
+        fwrite(row, sizeof(float), 3 * FRAME_WIDTH, file);
     }
-    if (hit.material->flags & (MT_REFLECTIVE | MT_REFRACTIVE))
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+// Fails when the file is missing, truncated or not a little-endian PFM of the frame size.
+int frame_load_pfm(Frame *const frame, char const *path)
+{
+    FILE *const file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    int width = 0;
+    int height = 0;
+    float scale = 0.0f;
+    if (fscanf(file, "PF %d %d %f", &width, &height, &scale) != 3 || fgetc(file) != '\n' ||
+        width != FRAME_WIDTH || height != FRAME_HEIGHT || scale >= 0.0f)
     {
-        Vec3 const reflectance = material_shade_fresnel(hit.material, hit.normal, viewDir);
+        fclose(file);
+        return -1;
+    }
 
-        if (hit.material->flags & MT_REFLECTIVE)
+    float row[3 * FRAME_WIDTH];
+    for (uint32_t y = 0; y < FRAME_HEIGHT; ++y)
+    {
+        if (fread(row, sizeof(float), 3 * FRAME_WIDTH, file) != 3 * FRAME_WIDTH)
         {
-            Vec3 const reflectedDirection = vec3_norm(vec3_reflect(hit.normal, ray->direction));
-            Ray const reflectedRay = {vec3_add(hit.position, vec3_scale(PRECISION, hit.normal)), reflectedDirection};
-            outRadiance = vec3_add(outRadiance, vec3_mul(reflectance, scene_raytrace(scene, &reflectedRay, depth + 1)));
+            fclose(file);
+            return -1;
         }
-        if (hit.material->flags & MT_REFRACTIVE)
+        for (uint32_t x = 0; x < FRAME_WIDTH; ++x)
         {
-            Vec3 const refractedDirection = vec3_norm(vec3_refract(hit.normal, ray->direction, hit.material->refrIdx));
-            Ray const refractedRay = {vec3_sub(hit.position, vec3_scale(PRECISION, hit.normal)), refractedDirection};
-            outRadiance = vec3_add(outRadiance, vec3_mul(vec3_sub(vec3_one(), reflectance), scene_raytrace(scene, &refractedRay, depth + 1)));
+            frame->data[y * FRAME_WIDTH + x] = LITERAL(Vec3){.r = row[3 * x + 0], .g = row[3 * x + 1], .b = row[3 * x + 2]};
         }
     }
 
-    return outRadiance;
+    fclose(file);
+
+    return 0;
 }
 
-float scene_render(Scene const *const scene, Frame *const frame)
+// Writes the absolute difference as a PPM, amplified by DIFF_IMAGE_GAIN so small deviations stay visible.
+int frame_save_diff(Frame const *const frame, Frame const *const reference, char const *path)
 {
-    clock_t const start = clock();
+    FILE *const file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
 
-    float const normalizingFactor = 1.0f / SAMPLES_PER_PIXEL;
+    fprintf(file, "P6\n%d %d\n255\n", FRAME_WIDTH, FRAME_HEIGHT);
 
-    for (uint32_t y = 0; y < FRAME_HEIGHT; ++y)
+    Vec3 diff[FRAME_WIDTH];
+    uint8_t row[3 * FRAME_WIDTH];
+    for (int32_t y = FRAME_HEIGHT - 1; y >= 0; --y)
     {
         for (uint32_t x = 0; x < FRAME_WIDTH; ++x)
         {
-            Vec2 pixelSamples[SAMPLES_PER_PIXEL] =
-            {
-                LITERAL(Vec2){.x = rand_float(0.0f, 0.5f), .y = rand_float(0.5f, 1.0f)},
-                LITERAL(Vec2){.x = rand_float(0.5f, 1.0f), .y = rand_float(0.5f, 1.0f)},
-                LITERAL(Vec2){.x = rand_float(0.0f, 0.5f), .y = rand_float(0.0f, 0.5f)},
-                LITERAL(Vec2){.x = rand_float(0.5f, 1.0f), .y = rand_float(0.0f, 0.5f)}
-            };
-            Vec3 pixelColor = vec3_zero();
-            for (uint8_t sample = 0; sample < SAMPLES_PER_PIXEL; ++sample)
+            Vec3 const a = frame->data[y * FRAME_WIDTH + (int32_t)x];
+            Vec3 const b = reference->data[y * FRAME_WIDTH + (int32_t)x];
+            float const gain = (float)DIFF_IMAGE_GAIN;
+            diff[x] = LITERAL(Vec3){.r = gain * fabsf(a.r - b.r), .g = gain * fabsf(a.g - b.g), .b = gain * fabsf(a.b - b.b)};
+        }
+        render_kernels()->convertRgb8(diff, row, FRAME_WIDTH);
+        fwrite(row, 1, sizeof(row), file);
+    }
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+FrameComparison frame_compare(Frame const *const frame, Frame const *const reference, float tolerance)
+{
+    FrameComparison comparison = {0.0f, FLT_MAX, 0};
+    double squaredError = 0.0;
+
+    for (uint32_t i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i)
+    {
+        float pixelError = 0.0f;
+        for (uint8_t c = 0; c < 3; ++c)
+        {
+            float const error = fabsf(frame->data[i].v[c] - reference->data[i].v[c]);
+            pixelError = fmaxf(pixelError, error);
+            squaredError += (double)error * (double)error;
+        }
+
+        comparison.maxError = fmaxf(comparison.maxError, pixelError);
+        comparison.mismatchCount += pixelError > tolerance ? 1 : 0;
+    }
+
+    if (squaredError > 0.0) {
+        comparison.psnr = (float)(-10.0 * log10(squaredError / (3.0 * FRAME_WIDTH * FRAME_HEIGHT)));
+    }
+
+    return comparison;
+}
+
+// Returns 0 when no pixel is off by more than tolerance and the PSNR reaches minPsnr. Otherwise the difference is
+// reported, written to diffPath unless it is NULL, and -1 is returned.
+int frame_check(Frame const *const frame, Frame const *const reference, float tolerance, float minPsnr, char const *diffPath)
+{
+    FrameComparison const comparison = frame_compare(frame, reference, tolerance);
+    if (comparison.mismatchCount == 0 && comparison.psnr >= minPsnr) {
+        return 0;
+    }
+
+    printf("Frame differs from its reference: max error %g, PSNR %.2f dB, %u pixels off by more than %g.\n",
+            (double)comparison.maxError, (double)comparison.psnr, comparison.mismatchCount, (double)tolerance);
+    if (diffPath != NULL && frame_save_diff(frame, reference, diffPath) == 0) {
+        printf("Difference is saved as \'%s\'.\n", diffPath);
+    }
+
+    return -1;
+}
+
+void frame_upscale(Frame *const frame, Vec3 const *pixels, uint32_t width, uint32_t height, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    // Bilinearly resamples the source rectangle [x0, x1) x [y0, y1) into the frame pixels it covers.
+    float const scaleX = (float)width / FRAME_WIDTH;
+    float const scaleY = (float)height / FRAME_HEIGHT;
+
+    for (uint32_t y = y0 * FRAME_HEIGHT / height, yEnd = y1 * FRAME_HEIGHT / height; y < yEnd; ++y)
+    {
+        float const sy = clamp(((float)y + 0.5f) * scaleY - 0.5f, 0.0f, (float)(height - 1));
+        uint32_t const sy0 = (uint32_t)sy;
+        uint32_t const sy1 = sy0 + 1 < height ? sy0 + 1 : sy0;
+        float const ty = sy - (float)sy0;
+
+        for (uint32_t x = x0 * FRAME_WIDTH / width, xEnd = x1 * FRAME_WIDTH / width; x < xEnd; ++x)
+        {
+            float const sx = clamp(((float)x + 0.5f) * scaleX - 0.5f, 0.0f, (float)(width - 1));
+            uint32_t const sx0 = (uint32_t)sx;
+            uint32_t const sx1 = sx0 + 1 < width ? sx0 + 1 : sx0;
+            float const tx = sx - (float)sx0;
+
+            Vec3 const bottom = vec3_lerp(pixels[sy0 * width + sx0], pixels[sy0 * width + sx1], tx);
+            Vec3 const top = vec3_lerp(pixels[sy1 * width + sx0], pixels[sy1 * width + sx1], tx);
+
+            frame->data[y * FRAME_WIDTH + x] = vec3_lerp(bottom, top, ty);
+        }
+    }
+}
+
+RenderSettings rendersettings_default(void)
+{
+    RenderSettings settings;
+
+    settings.width = FRAME_WIDTH;
+    settings.height = FRAME_HEIGHT;
+    settings.samplesPerPixel = SAMPLES_PER_PIXEL;
+    settings.maxDepth = MAX_RAY_DEPTH;
+
+    return settings;
+}
+
+BudgetController budgetcontroller_create(float targetFrameTime)
+{
+    BudgetController controller;
+
+    controller.targetFrameTime = targetFrameTime;
+    controller.costPerSample = 0.0f;
+    controller.settings = rendersettings_default();
+
+    return controller;
+}
+
+void budgetcontroller_update(BudgetController *const controller, float frameTime)
+{
+    RenderSettings *const settings = &(controller->settings);
+
+    float const sampleCount = (float)settings->width * (float)settings->height * (float)settings->samplesPerPixel;
+    float const cost = frameTime / sampleCount;
+
+    // A frame too short for the timer says nothing about the cost, the settings are kept until one is measured.
+    if (!(cost > 0.0f)) {
+        return;
+    }
+
+    // Smoothed, so that a single slow frame does not make the quality oscillate.
+    controller->costPerSample = controller->costPerSample > 0.0f ? 0.7f * controller->costPerSample + 0.3f * cost : cost;
+
+    float const affordableSamples = 0.9f * controller->targetFrameTime / controller->costPerSample;
+    float const framePixelCount = (float)FRAME_WIDTH * FRAME_HEIGHT;
+
+    // Samples per pixel are given up first, then resolution, and ray depth only as a last resort.
+    float const samplesPerPixel = clamp(floorf(affordableSamples / framePixelCount), 1.0f, SAMPLES_PER_PIXEL);
+    settings->samplesPerPixel = (uint32_t)samplesPerPixel;
+
+    float const scale = clamp(sqrtf(affordableSamples / (framePixelCount * samplesPerPixel)), MIN_RENDER_SCALE, 1.0f);
+    settings->width = (uint32_t)(scale * FRAME_WIDTH + 0.5f);
+    settings->height = (uint32_t)(scale * FRAME_HEIGHT + 0.5f);
+    settings->width = settings->width < 1 ? 1 : settings->width;
+    settings->height = settings->height < 1 ? 1 : settings->height;
+
+    if (frameTime > controller->targetFrameTime && scale <= MIN_RENDER_SCALE && settings->maxDepth > 1) {
+        --settings->maxDepth;
+    } else if (frameTime < 0.5f * controller->targetFrameTime && settings->maxDepth < MAX_RAY_DEPTH) {
+        ++settings->maxDepth;
+    }
+}
+
+// Bresenham line from (x0, y0) to (x1, y1) thickened along its minor axis. Only the pixels inside
+// [0, width) x [0, height) are written: the mask ones are set when mask is given, otherwise the pixels get the color.
+static void raster_line(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint8_t thickness,
+                        int32_t width, int32_t height, uint8_t *const mask, Vec3 *const pixels, Vec3 color)
+{
+    int32_t const margin = thickness / 2 + 1;
+    if ((x0 < -margin && x1 < -margin) || (x0 >= width + margin && x1 >= width + margin) ||
+        (y0 < -margin && y1 < -margin) || (y0 >= height + margin && y1 >= height + margin)) {
+        return;
+    }
+
+    int32_t const dx = abs(x1 - x0);
+    int32_t const dy = -abs(y1 - y0);
+    int32_t const sx = x0 < x1 ? 1 : -1;
+    int32_t const sy = y0 < y1 ? 1 : -1;
+    int32_t const steep = -dy > dx;
+    int32_t const passes = thickness < 1 ? 1 : thickness;
+
+    for (int32_t x = x0, y = y0, err = dx + dy;;)
+    {
+        for (int32_t i = 0; i < passes; ++i)
+        {
+            int32_t const offset = (i & 1) ? (i + 1) / 2 : -(i / 2);
+            int32_t const px = steep ? x + offset : x;
+            int32_t const py = steep ? y : y + offset;
+
+            if (px >= 0 && px < width && py >= 0 && py < height) {
+                if (mask) {
+                    mask[py * width + px] = 1;
+                } else {
+                    pixels[py * width + px] = color;
+                }
+            }
+        }
+
+        if (x == x1 && y == y1) {
+            break;
+        }
+
+        int32_t const e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y += sy;
+        }
+    }
+}
+
+void line_render(Frame *const frame, Vec2 start, Vec2 end, Vec3 color, uint8_t thickness)
+{
+    raster_line((int32_t)floorf(start.x + 0.5f), (int32_t)floorf(start.y + 0.5f), (int32_t)floorf(end.x + 0.5f), (int32_t)floorf(end.y + 0.5f),
+                thickness, FRAME_WIDTH, FRAME_HEIGHT, NULL, frame->data, color);
+}
+
+static inline char glyph_character_map(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0' + ('Z' - 'A' + 1);
+    }
+    if (c == '-') {
+        return 36;
+    }
+    if (c == '.') {
+        return 37;
+    }
+    if (c == '/') {
+        return 38;
+    }
+    if (c == ' ') {
+        return -1;
+    }
+
+    // Convert character to lower case.
+    c |= 0x20;
+
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a';
+    }
+
+    return 39;
+}
+
+// Rounded pixel coordinates of the glyph polyline, returns 0 for characters without strokes.
+static int glyph_points(char c, Vec2 position, uint8_t size, int32_t points[GLYPH_DATA_SIZE])
+{
+    char const index = glyph_character_map(c);
+    if (index == -1) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < GLYPH_DATA_SIZE; i += 2)
+    {
+        points[i] = (int32_t)floorf(size * font[(int)index][i] + position.x + 0.5f);
+        points[i+1] = (int32_t)floorf(size * font[(int)index][i+1] + position.y + 0.5f);
+    }
+
+    return 1;
+}
+
+void text_render(Frame *const frame, char const *text, Vec2 position, uint8_t size, Vec3 color)
+{
+    float const step = 1.5f * size;
+    int32_t points[GLYPH_DATA_SIZE];
+
+    char c;
+    while ((c = *(text++)))
+    {
+        if (glyph_points(c, position, size, points)) {
+            for (size_t i = 0; i + 2 < GLYPH_DATA_SIZE; i += 2)
             {
-                Vec2 const *const pixelSample = pixelSamples + sample;
-                Ray const ray = camera_get_ray(&(scene->camera), x, y, FRAME_WIDTH, FRAME_HEIGHT, pixelSample->x, pixelSample->y);
-                pixelColor = vec3_add(pixelColor, scene_raytrace(scene, &ray, 0));
+                raster_line(points[i], points[i+1], points[i+2], points[i+3], 1, FRAME_WIDTH, FRAME_HEIGHT, NULL, frame->data, color);
             }
-            frame->data[y * FRAME_WIDTH + x] = vec3_scale(normalizingFactor, pixelColor);
         }
+
+        position.x += step;
     }
+}
 
-    // Returns the frame time in seconds.
-    return (float)(clock() - start) / CLOCKS_PER_SEC;
+void textoverlay_set(TextOverlay *const overlay, char const *text, Vec2 position, uint8_t size)
+{
+    if (overlay->size == size && overlay->position.x == position.x && overlay->position.y == position.y &&
+        strncmp(overlay->text, text, OVERLAY_MAX_TEXT_LENGTH - 1) == 0) {
+        return;
+    }
+
+    strncpy(overlay->text, text, OVERLAY_MAX_TEXT_LENGTH - 1);
+    overlay->text[OVERLAY_MAX_TEXT_LENGTH - 1] = '\0';
+    overlay->position = position;
+    overlay->size = size;
+    overlay->maskY = (int32_t)floorf(position.y + 0.5f);
+    memset(overlay->mask, 0, sizeof(overlay->mask));
+
+    // Covered area before clipping, the strokes of the glyphs may leave their unit box a little.
+    int32_t x0 = INT32_MAX, x1 = INT32_MIN, y0 = INT32_MAX, y1 = INT32_MIN;
+    float const step = 1.5f * size;
+    int32_t points[GLYPH_DATA_SIZE];
+
+    for (char const *c = overlay->text; *c; ++c, position.x += step)
+    {
+        if (!glyph_points(*c, position, size, points)) {
+            continue;
+        }
+
+        for (size_t i = 0; i < GLYPH_DATA_SIZE; i += 2)
+        {
+            x0 = points[i] < x0 ? points[i] : x0;
+            x1 = points[i] + 1 > x1 ? points[i] + 1 : x1;
+            y0 = points[i+1] < y0 ? points[i+1] : y0;
+            y1 = points[i+1] + 1 > y1 ? points[i+1] + 1 : y1;
+            points[i+1] -= overlay->maskY;
+        }
+
+        for (size_t i = 0; i + 2 < GLYPH_DATA_SIZE; i += 2)
+        {
+            raster_line(points[i], points[i+1], points[i+2], points[i+3], 1, FRAME_WIDTH, OVERLAY_MASK_HEIGHT, overlay->mask, NULL, vec3_zero());
+        }
+    }
+
+    // Clip to the frame and to the rows the mask holds.
+    overlay->x0 = x0 < 0 ? 0 : x0;
+    overlay->x1 = x1 > FRAME_WIDTH ? FRAME_WIDTH : x1;
+    overlay->y0 = y0 < overlay->maskY ? overlay->maskY : y0;
+    overlay->y0 = overlay->y0 < 0 ? 0 : overlay->y0;
+    overlay->y1 = y1 > overlay->maskY + OVERLAY_MASK_HEIGHT ? overlay->maskY + OVERLAY_MASK_HEIGHT : y1;
+    overlay->y1 = overlay->y1 > FRAME_HEIGHT ? FRAME_HEIGHT : overlay->y1;
+}
+
+void textoverlay_render(Frame *const frame, TextOverlay const *const overlay, Vec3 color)
+{
+    for (int32_t y = overlay->y0; y < overlay->y1; ++y)
+    {
+        uint8_t const *mask = overlay->mask + (y - overlay->maskY) * FRAME_WIDTH;
+        Vec3 *pixels = frame->data + y * FRAME_WIDTH;
+
+        for (int32_t x = overlay->x0; x < overlay->x1; ++x)
+        {
+            pixels[x] = mask[x] ? color : pixels[x];
+        }
+    }
+}
+
+Scene scene_create(Arena *const arena, ResourcePool const *resources, Camera cam, Vec3 La)
+{
+    Scene scene;
+
+    scene.arena = arena;
+    scene.resources = resources;
+    scene.spheres = NULL;
+    scene.sphereCount = 0;
+    scene.sphereCapacity = 0;
+    scene.lights = NULL;
+    scene.lightCount = 0;
+    scene.lightCapacity = 0;
+    scene.lightTree = NULL;
+    scene.lightTreeCount = 0;
+    scene.lightTreeCapacity = 0;
+    scene.lightSamples = LIGHT_SAMPLES_PER_HIT;
+    scene.camera = cam;
+    scene.ambientLight = La;
+    scene.packedSpheres = NULL;
+    scene.seed = 0;
+
+    return scene;
+}
+
+// Refuses spheres whose material is not in the resource pool of the scene, rendering would read past its materials.
+SphereHandle scene_add_sphere(Scene *const scene, Sphere sphere)
+{
+    if (sphere.material >= scene->resources->materialCount) {
+        return INVALID_HANDLE;
+    }
+
+    Sphere *const spheres = (Sphere *)arena_grow(scene->arena, scene->spheres, scene->sphereCount, &(scene->sphereCapacity), sizeof(Sphere));
+    if (spheres == NULL) {
+        return INVALID_HANDLE;
+    }
+
+    scene->spheres = spheres;
+    scene->spheres[scene->sphereCount] = sphere;
+
+    return scene->sphereCount++;
+}
+
+LightHandle scene_add_light(Scene *const scene, Light light)
+{
+    Light *const lights = (Light *)arena_grow(scene->arena, scene->lights, scene->lightCount, &(scene->lightCapacity), sizeof(Light));
+    if (lights == NULL) {
+        return INVALID_HANDLE;
+    }
+
+    scene->lights = lights;
+    scene->lights[scene->lightCount] = light;
+
+    return scene->lightCount++;
+}
+
+Sphere *scene_get_sphere(Scene const *const scene, SphereHandle handle)
+{
+    return handle < scene->sphereCount ? &(scene->spheres[handle]) : NULL;
+}
+
+Light *scene_get_light(Scene const *const scene, LightHandle handle)
+{
+    return handle < scene->lightCount ? &(scene->lights[handle]) : NULL;
+}
+
+// Keeps the storage, so refilling the scene does not touch the arena until it outgrows its previous size.
+void scene_clear(Scene *const scene)
+{
+    scene->sphereCount = 0;
+    scene->lightCount = 0;
+    scene->lightTreeCount = 0;
+}
+
+// Copies src into the storage of dst, which only allocates when dst has never held that many spheres or lights.
+int scene_copy(Scene *const dst, Scene const *const src)
+{
+    if (dst->sphereCapacity < src->sphereCount)
+    {
+        Sphere *const spheres = (Sphere *)arena_alloc(dst->arena, src->sphereCount * sizeof(Sphere), ARENA_ALIGNMENT);
+        if (spheres == NULL) {
+            return -1;
+        }
+        dst->spheres = spheres;
+        dst->sphereCapacity = src->sphereCount;
+    }
+    if (dst->lightCapacity < src->lightCount)
+    {
+        Light *const lights = (Light *)arena_alloc(dst->arena, src->lightCount * sizeof(Light), ARENA_ALIGNMENT);
+        if (lights == NULL) {
+            return -1;
+        }
+        dst->lights = lights;
+        dst->lightCapacity = src->lightCount;
+    }
+    if (dst->lightTreeCapacity < src->lightTreeCount)
+    {
+        uint32_t const nodeCount = 2 * src->lightTreeCount - 1;
+        LightTreeNode *const nodes = (LightTreeNode *)arena_alloc(dst->arena, nodeCount * sizeof(LightTreeNode), ARENA_ALIGNMENT);
+        if (nodes == NULL) {
+            return -1;
+        }
+        dst->lightTree = nodes;
+        dst->lightTreeCapacity = src->lightTreeCount;
+    }
+
+    if (src->sphereCount > 0) {
+        memcpy(dst->spheres, src->spheres, src->sphereCount * sizeof(Sphere));
+    }
+    if (src->lightCount > 0) {
+        memcpy(dst->lights, src->lights, src->lightCount * sizeof(Light));
+    }
+    if (src->lightTreeCount > 0) {
+        memcpy(dst->lightTree, src->lightTree, (2 * src->lightTreeCount - 1) * sizeof(LightTreeNode));
+    }
+
+    dst->resources = src->resources;
+    dst->sphereCount = src->sphereCount;
+    dst->lightCount = src->lightCount;
+    dst->lightTreeCount = src->lightTreeCount;
+    dst->lightSamples = src->lightSamples;
+    dst->camera = src->camera;
+    dst->ambientLight = src->ambientLight;
+    dst->packedSpheres = src->packedSpheres;
+    dst->seed = src->seed;
+
+    return 0;
+}
+
+void scene_set_packed_spheres(Scene *const scene, PackedSpheres const *packed)
+{
+    scene->packedSpheres = packed;
+}
+
+static inline float light_power(Light const *const light)
+{
+    return 0.2126f * light->exitance.r + 0.7152f * light->exitance.g + 0.0722f * light->exitance.b;
+}
+
+static inline uint32_t morton_spread(uint32_t v)
+{
+    v = (v | (v << 16)) & 0x030000FFu;
+    v = (v | (v << 8)) & 0x0300F00Fu;
+    v = (v | (v << 4)) & 0x030C30C3u;
+    v = (v | (v << 2)) & 0x09249249u;
+
+    return v;
+}
+
+static int compare_u64(void const *a, void const *b)
+{
+    uint64_t const lhs = *(uint64_t const *)a;
+    uint64_t const rhs = *(uint64_t const *)b;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+// Builds a balanced tree over the lights in Morton order, so nearby point and spot lights share subtrees and
+// directional lights end up together. Capacity is kept, rebuilding only allocates when lights were added.
+int scene_build_light_tree(Scene *const scene)
+{
+    uint32_t const count = scene->lightCount;
+
+    scene->lightTreeCount = 0;
+    if (count == 0) {
+        return 0;
+    }
+    if (scene->lightTreeCapacity < count)
+    {
+        LightTreeNode *const nodes = (LightTreeNode *)arena_alloc(scene->arena, (2 * count - 1) * sizeof(LightTreeNode), ARENA_ALIGNMENT);
+        if (nodes == NULL) {
+            return -1;
+        }
+        scene->lightTree = nodes;
+        scene->lightTreeCapacity = count;
+    }
+
+    LightTreeNode *const nodes = scene->lightTree;
+    Vec3 boundsMin = vec3_scale(FLT_MAX, vec3_one());
+    Vec3 boundsMax = vec3_scale(-FLT_MAX, vec3_one());
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        Light const *const light = &(scene->lights[i]);
+        if (light->type != LT_DIRECTIONAL)
+        {
+            boundsMin = LITERAL(Vec3){.x = fminf(boundsMin.x, light->position.x), .y = fminf(boundsMin.y, light->position.y), .z = fminf(boundsMin.z, light->position.z)};
+            boundsMax = LITERAL(Vec3){.x = fmaxf(boundsMax.x, light->position.x), .y = fmaxf(boundsMax.y, light->position.y), .z = fmaxf(boundsMax.z, light->position.z)};
+        }
+    }
+    Vec3 const extent = vec3_sub(boundsMax, boundsMin);
+
+    // The sort keys live in the count - 1 inner nodes, which are only filled after the leaves.
+    uint64_t *const keys = (uint64_t *)(void *)nodes;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        Light const *const light = &(scene->lights[i]);
+        uint32_t code = UINT32_MAX;
+        if (light->type != LT_DIRECTIONAL)
+        {
+            Vec3 const offset = vec3_sub(light->position, boundsMin);
+            uint32_t const qx = extent.x > 0.0f ? (uint32_t)(1023.0f * offset.x / extent.x) : 0;
+            uint32_t const qy = extent.y > 0.0f ? (uint32_t)(1023.0f * offset.y / extent.y) : 0;
+            uint32_t const qz = extent.z > 0.0f ? (uint32_t)(1023.0f * offset.z / extent.z) : 0;
+            code = (morton_spread(qx) << 2) | (morton_spread(qy) << 1) | morton_spread(qz);
+        }
+        keys[i] = ((uint64_t)code << 32) | i;
+    }
+    qsort(keys, count, sizeof(uint64_t), compare_u64);
+
+    // Leaves fill nodes count - 1 to 2 * count - 2, the ones on the deepest level come first in tree order.
+    uint32_t deepFirst = 0;
+    while (2 * deepFirst + 1 <= 2 * count - 2)
+    {
+        deepFirst = 2 * deepFirst + 1;
+    }
+    uint32_t const deepCount = 2 * count - 1 - deepFirst;
+
+    for (uint32_t rank = 0; rank < count; ++rank)
+    {
+        LightHandle const handle = (LightHandle)(keys[rank] & UINT32_MAX);
+        Light const *const light = &(scene->lights[handle]);
+        LightTreeNode *const leaf = &(nodes[rank < deepCount ? deepFirst + rank : count - 1 + rank - deepCount]);
+
+        if (light->type == LT_DIRECTIONAL) {
+            *leaf = LITERAL(LightTreeNode){vec3_scale(FLT_MAX, vec3_one()), vec3_scale(-FLT_MAX, vec3_one()), 0.0f, light_power(light), handle};
+        } else {
+            *leaf = LITERAL(LightTreeNode){light->position, light->position, light_power(light), 0.0f, handle};
+        }
+    }
+
+    for (uint32_t i = count - 1; i-- > 0;)
+    {
+        LightTreeNode const *const left = &(nodes[2 * i + 1]);
+        LightTreeNode const *const right = &(nodes[2 * i + 2]);
+
+        nodes[i].boundsMin = LITERAL(Vec3){.x = fminf(left->boundsMin.x, right->boundsMin.x), .y = fminf(left->boundsMin.y, right->boundsMin.y), .z = fminf(left->boundsMin.z, right->boundsMin.z)};
+        nodes[i].boundsMax = LITERAL(Vec3){.x = fmaxf(left->boundsMax.x, right->boundsMax.x), .y = fmaxf(left->boundsMax.y, right->boundsMax.y), .z = fmaxf(left->boundsMax.z, right->boundsMax.z)};
+        nodes[i].power = left->power + right->power;
+        nodes[i].directionalPower = left->directionalPower + right->directionalPower;
+        nodes[i].light = INVALID_HANDLE;
+    }
+
+    scene->lightTreeCount = count;
+
+    return 0;
+}
+
+// Nearest sphere with a positive hit distance, -1 when the ray misses all of them.
+static float spheres_nearest(Sphere const *spheres, uint32_t count, Ray const *ray, int32_t *index)
+{
+    float bestT = -1.0f;
+    *index = -1;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        float const t = sphere_intersect_t(&spheres[i], ray);
+
+        if (t > 0.0f && (bestT < 0.0f || t < bestT))
+        {
+            bestT = t;
+            *index = (int32_t)i;
+        }
+    }
+
+    return bestT;
+}
+
+#ifdef TRAYRACING_DISPATCH
+// Picks the nearest of the per-lane winners, on ties the lowest index like the sequential loop.
+static float spheres_nearest_reduce(float const *t, int32_t const *sphereIndex, uint32_t laneCount, int32_t *index)
+{
+    float bestT = FLT_MAX;
+    *index = -1;
+
+    for (uint32_t lane = 0; lane < laneCount; ++lane)
+    {
+        if (sphereIndex[lane] >= 0 && (t[lane] < bestT || (t[lane] == bestT && sphereIndex[lane] < *index)))
+        {
+            bestT = t[lane];
+            *index = sphereIndex[lane];
+        }
+    }
+
+    return *index < 0 ? -1.0f : bestT;
+}
+
+// Spheres are gathered straight from the scene, eight at a time, with the arithmetic of sphere_intersect_t.
+TRAYRACING_TARGET_AVX2 static float spheres_nearest_avx2(Sphere const *spheres, uint32_t count, Ray const *ray, int32_t *index)
+{
+    float const *const centers = (float const *)spheres + offsetof(Sphere, center) / sizeof(float);
+    float const *const radii = (float const *)spheres + offsetof(Sphere, radius) / sizeof(float);
+    __m256i const stride = _mm256_set1_epi32((int32_t)(sizeof(Sphere) / sizeof(float)));
+    __m256i const lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i const sphereCount = _mm256_set1_epi32((int32_t)count);
+    __m256 const zero = _mm256_setzero_ps();
+
+    __m256 const originX = _mm256_set1_ps(ray->origin.x);
+    __m256 const originY = _mm256_set1_ps(ray->origin.y);
+    __m256 const originZ = _mm256_set1_ps(ray->origin.z);
+    __m256 const directionX = _mm256_set1_ps(ray->direction.x);
+    __m256 const directionY = _mm256_set1_ps(ray->direction.y);
+    __m256 const directionZ = _mm256_set1_ps(ray->direction.z);
+
+    __m256 bestT = _mm256_set1_ps(FLT_MAX);
+    __m256i bestIndex = _mm256_set1_epi32(-1);
+
+    for (uint32_t i = 0; i < count; i += 8)
+    {
+        __m256i const sphereIndex = _mm256_add_epi32(_mm256_set1_epi32((int32_t)i), lanes);
+        __m256 const inside = _mm256_castsi256_ps(_mm256_cmpgt_epi32(sphereCount, sphereIndex));
+        __m256i const offset = _mm256_mullo_epi32(sphereIndex, stride);
+
+        __m256 const distX = _mm256_sub_ps(originX, _mm256_mask_i32gather_ps(zero, centers, offset, inside, 4));
+        __m256 const distY = _mm256_sub_ps(originY, _mm256_mask_i32gather_ps(zero, centers + 1, offset, inside, 4));
+        __m256 const distZ = _mm256_sub_ps(originZ, _mm256_mask_i32gather_ps(zero, centers + 2, offset, inside, 4));
+        __m256 const radius = _mm256_mask_i32gather_ps(zero, radii, offset, inside, 4);
+
+        __m256 const b = _mm256_mul_ps(_mm256_set1_ps(2.0f), _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(distX, directionX), _mm256_mul_ps(distY, directionY)), _mm256_mul_ps(distZ, directionZ)));
+        __m256 const c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(distX, distX), _mm256_mul_ps(distY, distY)), _mm256_mul_ps(distZ, distZ)), _mm256_mul_ps(radius, radius));
+        __m256 const disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(_mm256_set1_ps(4.0f), c));
+        __m256 const sqrtDisc = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+        __m256 const tNear = _mm256_mul_ps(_mm256_set1_ps(-0.5f), _mm256_add_ps(b, sqrtDisc));
+        __m256 const t = _mm256_blendv_ps(_mm256_add_ps(tNear, sqrtDisc), tNear, _mm256_cmp_ps(tNear, zero, _CMP_GT_OQ));
+
+        __m256 const closer = _mm256_and_ps(_mm256_and_ps(inside, _mm256_cmp_ps(disc, zero, _CMP_GE_OQ)),
+                                            _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GT_OQ), _mm256_cmp_ps(t, bestT, _CMP_LT_OQ)));
+        bestT = _mm256_blendv_ps(bestT, t, closer);
+        bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(sphereIndex), closer));
+    }
+
+    float laneT[8];
+    int32_t laneIndex[8];
+    _mm256_storeu_ps(laneT, bestT);
+    _mm256_storeu_si256((__m256i *)laneIndex, bestIndex);
+
+    return spheres_nearest_reduce(laneT, laneIndex, 8, index);
+}
+
+// Without optimization the gather intrinsics are macros that trip -Wsign-conversion inside GCC's own headers.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+TRAYRACING_TARGET_AVX512 static float spheres_nearest_avx512(Sphere const *spheres, uint32_t count, Ray const *ray, int32_t *index)
+{
+    float const *const centers = (float const *)spheres + offsetof(Sphere, center) / sizeof(float);
+    float const *const radii = (float const *)spheres + offsetof(Sphere, radius) / sizeof(float);
+    __m512i const stride = _mm512_set1_epi32((int32_t)(sizeof(Sphere) / sizeof(float)));
+    __m512i const lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m512i const sphereCount = _mm512_set1_epi32((int32_t)count);
+    __m512 const zero = _mm512_setzero_ps();
+
+    __m512 const originX = _mm512_set1_ps(ray->origin.x);
+    __m512 const originY = _mm512_set1_ps(ray->origin.y);
+    __m512 const originZ = _mm512_set1_ps(ray->origin.z);
+    __m512 const directionX = _mm512_set1_ps(ray->direction.x);
+    __m512 const directionY = _mm512_set1_ps(ray->direction.y);
+    __m512 const directionZ = _mm512_set1_ps(ray->direction.z);
+
+    __m512 bestT = _mm512_set1_ps(FLT_MAX);
+    __m512i bestIndex = _mm512_set1_epi32(-1);
+
+    for (uint32_t i = 0; i < count; i += 16)
+    {
+        __m512i const sphereIndex = _mm512_add_epi32(_mm512_set1_epi32((int32_t)i), lanes);
+        __mmask16 const inside = _mm512_cmpgt_epi32_mask(sphereCount, sphereIndex);
+        // Lanes past the end read the first sphere again, their results are masked out below.
+        __m512i const offset = _mm512_maskz_mullo_epi32(inside, sphereIndex, stride);
+
+        __m512 const distX = _mm512_sub_ps(originX, _mm512_i32gather_ps(offset, centers, 4));
+        __m512 const distY = _mm512_sub_ps(originY, _mm512_i32gather_ps(offset, centers + 1, 4));
+        __m512 const distZ = _mm512_sub_ps(originZ, _mm512_i32gather_ps(offset, centers + 2, 4));
+        __m512 const radius = _mm512_i32gather_ps(offset, radii, 4);
+
+        __m512 const b = _mm512_mul_ps(_mm512_set1_ps(2.0f), _mm512_add_ps(_mm512_add_ps(
+            _mm512_mul_ps(distX, directionX), _mm512_mul_ps(distY, directionY)), _mm512_mul_ps(distZ, directionZ)));
+        __m512 const c = _mm512_sub_ps(_mm512_add_ps(_mm512_add_ps(
+            _mm512_mul_ps(distX, distX), _mm512_mul_ps(distY, distY)), _mm512_mul_ps(distZ, distZ)), _mm512_mul_ps(radius, radius));
+        __m512 const disc = _mm512_sub_ps(_mm512_mul_ps(b, b), _mm512_mul_ps(_mm512_set1_ps(4.0f), c));
+        __m512 const sqrtDisc = _mm512_sqrt_ps(_mm512_max_ps(disc, zero));
+        __m512 const tNear = _mm512_mul_ps(_mm512_set1_ps(-0.5f), _mm512_add_ps(b, sqrtDisc));
+        __m512 const t = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(tNear, zero, _CMP_GT_OQ), _mm512_add_ps(tNear, sqrtDisc), tNear);
+
+        __mmask16 const closer = (__mmask16)(inside & _mm512_cmp_ps_mask(disc, zero, _CMP_GE_OQ) &
+                                             _mm512_cmp_ps_mask(t, zero, _CMP_GT_OQ) & _mm512_cmp_ps_mask(t, bestT, _CMP_LT_OQ));
+        bestT = _mm512_mask_blend_ps(closer, bestT, t);
+        bestIndex = _mm512_mask_blend_epi32(closer, bestIndex, sphereIndex);
+    }
+
+    float laneT[16];
+    int32_t laneIndex[16];
+    _mm512_storeu_ps(laneT, bestT);
+    _mm512_storeu_si512(laneIndex, bestIndex);
+
+    return spheres_nearest_reduce(laneT, laneIndex, 16, index);
+}
+#pragma GCC diagnostic pop
+#endif
+
+// Intersects the given spheres, a subset of the scene known to contain every sphere the ray can hit, and the packed
+// spheres of the scene.
+static Hit scene_raycast_spheres(Scene const *const scene, Sphere const *const spheres, uint32_t sphereCount, Ray const *const ray)
+{
+    int32_t bestIdx;
+    PackedSphereCluster const *bestCluster = NULL;
+
+    float bestT = render_kernels()->spheresNearest(spheres, sphereCount, ray, &bestIdx);
+
+    PackedSpheres const *const packed = scene->packedSpheres;
+    if (packed != NULL)
+    {
+        Vec3 const invDir = ray_inv_direction(ray);
+
+        for (uint32_t c = 0; c < packed->clusterCount; ++c)
+        {
+            PackedSphereCluster const *const cluster = &(packed->clusters[c]);
+
+            if (!ray_hits_box(ray, invDir, cluster->boundsMin, cluster->boundsMax, bestT < 0.0f ? FLT_MAX : bestT)) {
+                continue;
+            }
+
+            for (uint8_t i = 0; i < cluster->count; ++i)
+            {
+                float const t = packedsphere_intersect_t(cluster, i, ray);
+
+                if (t > 0.0f && (bestT < 0.0f || t < bestT))
+                {
+                    bestT = t;
+                    bestIdx = i;
+                    bestCluster = cluster;
+                }
+            }
+        }
+    }
+
+    if (bestT < 0.0f)
+    {
+        Hit hit;
+        hit.t = bestT;
+
+        return hit;
+    }
+
+    if (bestCluster != NULL)
+    {
+        Sphere const sphere = packedsphere_decode(bestCluster, (uint8_t)bestIdx);
+
+        return sphere_intersect(&sphere, scene->resources->materials, ray, bestT);
+    }
+
+    return sphere_intersect(&spheres[bestIdx], scene->resources->materials, ray, bestT);
+}
+
+static Hit scene_raycast(Scene const *const scene, Ray const *const ray)
+{
+    return scene_raycast_spheres(scene, scene->spheres, scene->sphereCount, ray);
+}
+
+// Radiance arriving at position from the light, along with the direction towards it and the distance a shadow ray
+// has to cover.
+static Vec3 light_incident(Light const *const light, Vec3 position, Vec3 *const toLight, float *const distance)
+{
+    if (light->type == LT_DIRECTIONAL)
+    {
+        *toLight = vec3_norm(vec3_inv(light->direction));
+        *distance = FLT_MAX;
+
+        return light->exitance;
+    }
+
+    Vec3 const offset = vec3_sub(light->position, position);
+    float const distanceSqr = fmaxf(vec3_length_sqr(offset), PRECISION);
+    *distance = sqrtf(distanceSqr);
+    *toLight = vec3_scale(1.0f / *distance, offset);
+
+    float attenuation = 1.0f / distanceSqr;
+    if (light->type == LT_SPOT)
+    {
+        float const cosAngle = -vec3_dot(*toLight, vec3_norm(light->direction));
+        float const t = clamp((cosAngle - light->cosOuter) / fmaxf(light->cosInner - light->cosOuter, PRECISION), 0.0f, 1.0f);
+        attenuation *= t * t * (3.0f - 2.0f * t);
+    }
+
+    return vec3_scale(attenuation, light->exitance);
+}
+
+// Estimated contribution of the lights below the node to position, the directional ones are taken at full power.
+static inline float lighttreenode_importance(LightTreeNode const *const node, Vec3 position)
+{
+    float importance = node->directionalPower;
+    if (node->power > 0.0f)
+    {
+        Vec3 const center = vec3_scale(0.5f, vec3_add(node->boundsMin, node->boundsMax));
+        float const radiusSqr = 0.25f * vec3_length_sqr(vec3_sub(node->boundsMax, node->boundsMin));
+        importance += node->power / fmaxf(fmaxf(vec3_length_sqr(vec3_sub(center, position)), radiusSqr), PRECISION);
+    }
+
+    return importance;
+}
+
+// Picks a light with a probability roughly proportional to its contribution at position and returns that
+// probability in pdf. Without an up to date light tree every light is equally likely.
+static LightHandle scene_sample_light(Scene const *const scene, Vec3 position, uint32_t *const sampler, float *const pdf)
+{
+    if (scene->lightTreeCount != scene->lightCount)
+    {
+        *pdf = 1.0f / (float)scene->lightCount;
+
+        return (LightHandle)fminf(sampler_next(sampler) * (float)scene->lightCount, (float)(scene->lightCount - 1));
+    }
+
+    LightTreeNode const *const nodes = scene->lightTree;
+    uint32_t node = 0;
+    float probability = 1.0f;
+    while (nodes[node].light == INVALID_HANDLE)
+    {
+        float const left = lighttreenode_importance(&(nodes[2 * node + 1]), position);
+        float const right = lighttreenode_importance(&(nodes[2 * node + 2]), position);
+        float const pLeft = (left + right > 0.0f) ? left / (left + right) : 0.5f;
+
+        if (sampler_next(sampler) < pLeft) {
+            node = 2 * node + 1;
+            probability *= pLeft;
+        } else {
+            node = 2 * node + 2;
+            probability *= 1.0f - pLeft;
+        }
+    }
+
+    *pdf = probability;
+
+    return nodes[node].light;
+}
+
+// Direct light from one light source, the shadow ray is skipped when the surface faces away from it.
+static Vec3 scene_shade_light(Scene const *const scene, Hit const *const hit, Vec3 viewDir, Light const *const light)
+{
+    Vec3 toLight;
+    float distance;
+    Vec3 const inRadiance = light_incident(light, hit->position, &toLight, &distance);
+    if (vec3_dot(hit->normal, toLight) < 0.0f)
+    {
+        return vec3_zero();
+    }
+
+    Ray const shadowRay = {vec3_add(hit->position, vec3_scale(PRECISION, hit->normal)), toLight};
+    Hit const shadowHit = scene_raycast(scene, &shadowRay);
+    if (shadowHit.t >= 0.0f && shadowHit.t < distance)
+    {
+        return vec3_zero();
+    }
+
+    return material_shade_phong_blinn(hit->material, hit->normal, viewDir, toLight, inRadiance);
+}
+
+static Vec3 scene_raytrace(Scene const *const scene, Ray const *const ray, uint32_t *const sampler, uint8_t depth, uint8_t maxDepth);
+
+static Vec3 scene_shade(Scene const *const scene, Ray const *const ray, Hit const *const pHit, uint32_t *const sampler, uint8_t depth, uint8_t maxDepth)
+{
+    if (pHit->t < 0)
+    {
+        return scene->ambientLight;
+    }
+
+    Hit const hit = *pHit;
+    Vec3 outRadiance = vec3_zero();
+    Vec3 const viewDir = vec3_inv(ray->direction);
+
+    if (hit.material->flags & MT_ROUGH)
+    {
+        outRadiance = vec3_add(outRadiance, vec3_mul(hit.material->ambient, scene->ambientLight));
+        if (scene->lightCount <= scene->lightSamples)
+        {
+            for (uint32_t i = 0; i < scene->lightCount; ++i)
+            {
+                outRadiance = vec3_add(outRadiance, scene_shade_light(scene, &hit, viewDir, &(scene->lights[i])));
+            }
+        }
+        else
+        {
+            // Each sample is weighted by its inverse probability, so the estimate converges to the sum over all lights.
+            float const weight = 1.0f / (float)scene->lightSamples;
+            for (uint32_t i = 0; i < scene->lightSamples; ++i)
+            {
+                float pdf;
+                LightHandle const light = scene_sample_light(scene, hit.position, sampler, &pdf);
+                outRadiance = vec3_add(outRadiance, vec3_scale(weight / pdf, scene_shade_light(scene, &hit, viewDir, &(scene->lights[light]))));
+            }
+        }
+    }
+    if (hit.material->flags & (MT_REFLECTIVE | MT_REFRACTIVE))
+    {
+        Vec3 const reflectance = material_shade_fresnel(hit.material, hit.normal, viewDir);
+
+        if (hit.material->flags & MT_REFLECTIVE)
+        {
+            Vec3 const reflectedDirection = vec3_norm(vec3_reflect(hit.normal, ray->direction));
+            Ray const reflectedRay = {vec3_add(hit.position, vec3_scale(PRECISION, hit.normal)), reflectedDirection};
+            outRadiance = vec3_add(outRadiance, vec3_mul(reflectance, scene_raytrace(scene, &reflectedRay, sampler, depth + 1, maxDepth)));
+        }
+        if (hit.material->flags & MT_REFRACTIVE)
+        {
+            Vec3 const refractedDirection = vec3_norm(vec3_refract(hit.normal, ray->direction, hit.material->refrIdx));
+            Ray const refractedRay = {vec3_sub(hit.position, vec3_scale(PRECISION, hit.normal)), refractedDirection};
+            outRadiance = vec3_add(outRadiance, vec3_mul(vec3_sub(vec3_one(), reflectance), scene_raytrace(scene, &refractedRay, sampler, depth + 1, maxDepth)));
+        }
+    }
+
+    return outRadiance;
+}
+
+static Vec3 scene_raytrace(Scene const *const scene, Ray const *const ray, uint32_t *const sampler, uint8_t depth, uint8_t maxDepth)
+{
+    if (depth > maxDepth)
+    {
+        return scene->ambientLight;
+    }
+
+    Hit const hit = scene_raycast(scene, ray);
+
+    return scene_shade(scene, ray, &hit, sampler, depth, maxDepth);
+}
+
+static inline Vec3 material_albedo(Material const *const material)
+{
+    return (material->flags & MT_ROUGH) ? material->diffuse : material->minReflectance;
+}
+
+#define FRAME_TILE_COUNT_X ((FRAME_WIDTH + TILE_SIZE - 1) / TILE_SIZE)
+#define FRAME_TILE_COUNT_Y ((FRAME_HEIGHT + TILE_SIZE - 1) / TILE_SIZE)
+#define FRAME_TILE_COUNT (FRAME_TILE_COUNT_X * FRAME_TILE_COUNT_Y)
+
+static inline RenderView renderview_from_frame(Scene const *const scene, Frame *const frame)
+{
+    return LITERAL(RenderView){&(scene->camera), frame->data, FRAME_WIDTH, FRAME_HEIGHT, SAMPLES_PER_PIXEL, MAX_RAY_DEPTH, 0, NULL};
+}
+
+static inline RenderView renderview_from_settings(Scene const *const scene, RenderSettings const *const settings, Vec3 *const pixels)
+{
+    return LITERAL(RenderView){&(scene->camera), pixels, settings->width, settings->height, settings->samplesPerPixel, settings->maxDepth, 0, NULL};
+}
+
+static inline uint32_t renderview_tile_count(RenderView const *const view)
+{
+    return ((view->width + TILE_SIZE - 1) / TILE_SIZE) * ((view->height + TILE_SIZE - 1) / TILE_SIZE);
+}
+
+// Set on the thread rendering a reference frame, which takes none of the shortcuts the frame is there to check.
+static TRAYRACING_THREAD_LOCAL int threadRendersReference = 0;
+
+// Copies of the spheres primary rays of one tile can hit, compact so the sphere kernels run over them directly.
+typedef struct TileSpheres {
+    Sphere spheres[TILE_SPHERE_CAPACITY];
+    uint32_t count;
+} TileSpheres;
+
+// Keeps the spheres overlapping the pyramid from the eye through the pixels [x0, x1) x [y0, y1), which holds every
+// primary ray of them whatever their jitter. Returns 0 when more spheres are left than fit, the tile then has to test
+// all of them.
+static int tilespheres_cull(TileSpheres *const culled, Scene const *const scene, RenderView const *const view, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    Camera const *const camera = view->camera;
+    Vec3 const forward = vec3_sub(camera->lookat, camera->eye);
+    float const u0 = 2.0f * (float)x0 / (float)view->width - 1.0f;
+    float const u1 = 2.0f * (float)x1 / (float)view->width - 1.0f;
+    float const v0 = 2.0f * (float)y0 / (float)view->height - 1.0f;
+    float const v1 = 2.0f * (float)y1 / (float)view->height - 1.0f;
+
+    Vec3 const corners[4] = {
+        vec3_add(forward, vec3_add(vec3_scale(u0, camera->right), vec3_scale(v0, camera->up))),
+        vec3_add(forward, vec3_add(vec3_scale(u1, camera->right), vec3_scale(v0, camera->up))),
+        vec3_add(forward, vec3_add(vec3_scale(u1, camera->right), vec3_scale(v1, camera->up))),
+        vec3_add(forward, vec3_add(vec3_scale(u0, camera->right), vec3_scale(v1, camera->up)))
+    };
+    Vec3 const center = vec3_scale(0.25f, vec3_add(vec3_add(corners[0], corners[1]), vec3_add(corners[2], corners[3])));
+
+    // Side planes through the eye, facing into the pyramid.
+    Vec3 planes[4];
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        planes[i] = vec3_norm(vec3_cross(corners[i], corners[(i + 1) % 4]));
+        planes[i] = vec3_dot(planes[i], center) < 0.0f ? vec3_inv(planes[i]) : planes[i];
+    }
+
+    culled->count = 0;
+    for (uint32_t i = 0; i < scene->sphereCount; ++i)
+    {
+        Sphere const *const sphere = &(scene->spheres[i]);
+        Vec3 const offset = vec3_sub(sphere->center, camera->eye);
+        // Slightly widened, so rounding never drops a sphere a ray grazes.
+        float const reach = -(1.001f * sphere->radius + PRECISION);
+
+        if (vec3_dot(planes[0], offset) < reach || vec3_dot(planes[1], offset) < reach ||
+            vec3_dot(planes[2], offset) < reach || vec3_dot(planes[3], offset) < reach) {
+            continue;
+        }
+        if (culled->count == TILE_SPHERE_CAPACITY) {
+            return 0;
+        }
+        culled->spheres[culled->count++] = *sphere;
+    }
+
+    return 1;
+}
+
+// Samples are stratified over rows of the pixel, starting from the top one. Every row but the last holds columns
+// samples, and each row is as high as its share of the samples, so that all cells have the same area and together
+// cover the pixel whatever the sample count. The cell of the sample spans [lower.x, upper.x) x [lower.y, upper.y).
+static inline void pixel_sample_cell(uint32_t sample, uint32_t samplesPerPixel, uint32_t columns, Vec2 *const lower, Vec2 *const upper)
+{
+    uint32_t const rowStart = sample - sample % columns;
+    uint32_t const rowCount = samplesPerPixel - rowStart < columns ? samplesPerPixel - rowStart : columns;
+    uint32_t const column = sample - rowStart;
+
+    lower->x = (float)column / (float)rowCount;
+    upper->x = (float)(column + 1) / (float)rowCount;
+    lower->y = (float)(samplesPerPixel - rowStart - rowCount) / (float)samplesPerPixel;
+    upper->y = (float)(samplesPerPixel - rowStart) / (float)samplesPerPixel;
+}
+
+static inline uint32_t pixel_sample_columns(uint32_t samplesPerPixel)
+{
+    uint32_t columns = 1;
+    while (columns * columns < samplesPerPixel)
+    {
+        ++columns;
+    }
+
+    return columns;
+}
+
+static Vec3 scene_render_pixel(Scene const *const scene, RenderView const *const view, Sphere const *const spheres, uint32_t sphereCount, uint32_t x, uint32_t y)
+{
+    uint32_t sampler = hash_u32(scene->seed ^ hash_u32(y * view->width + x));
+    uint32_t const columns = pixel_sample_columns(view->samplesPerPixel);
+
+    Vec3 pixelColor = vec3_zero();
+    Vec3 normal = vec3_zero();
+    Vec3 albedo = vec3_zero();
+    float depth = 0.0f;
+
+    for (uint32_t sample = 0; sample < view->samplesPerPixel; ++sample)
+    {
+        Vec2 lower, upper;
+        pixel_sample_cell(sample, view->samplesPerPixel, columns, &lower, &upper);
+        float const xOffset = sampler_range(&sampler, lower.x, upper.x);
+        float const yOffset = sampler_range(&sampler, lower.y, upper.y);
+        Ray const ray = camera_get_ray(view->camera, x, y, view->width, view->height, xOffset, yOffset);
+
+        Hit const hit = scene_raycast_spheres(scene, spheres, sphereCount, &ray);
+        pixelColor = vec3_add(pixelColor, scene_shade(scene, &ray, &hit, &sampler, 0, view->maxDepth));
+
+        if (hit.t < 0.0f) {
+            albedo = vec3_add(albedo, scene->ambientLight);
+        } else {
+            normal = vec3_add(normal, hit.normal);
+            albedo = vec3_add(albedo, material_albedo(hit.material));
+            depth += hit.t;
+        }
+    }
+
+    float const normalizingFactor = 1.0f / (float)view->samplesPerPixel;
+
+    if (view->gbuffer != NULL)
+    {
+        uint32_t const index = y * view->width + x;
+        GBuffer *const gbuffer = view->gbuffer;
+
+        normal = vec3_norm(normal);
+        albedo = vec3_scale(normalizingFactor, albedo);
+
+        gbuffer->normalX[index] = normal.x;
+        gbuffer->normalY[index] = normal.y;
+        gbuffer->normalZ[index] = normal.z;
+        gbuffer->depth[index] = normalizingFactor * depth;
+        gbuffer->albedoR[index] = albedo.r;
+        gbuffer->albedoG[index] = albedo.g;
+        gbuffer->albedoB[index] = albedo.b;
+    }
+
+    return vec3_scale(normalizingFactor, pixelColor);
+}
+
+// Renders a rectangle of the view. The pixels of the view only hold the rows from firstRow on, which lets a band of
+// a large image be rendered without storing the rest.
+static void scene_render_view_rect(Scene const *const scene, RenderView const *const view, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t firstRow)
+{
+    // Primary rays only test the spheres in view of the rectangle, secondary rays go anywhere and test all of them.
+    TileSpheres culled;
+    int const isCulled = !threadRendersReference && tilespheres_cull(&culled, scene, view, x0, y0, x1, y1);
+    Sphere const *const spheres = isCulled ? culled.spheres : scene->spheres;
+    uint32_t const sphereCount = isCulled ? culled.count : scene->sphereCount;
+
+    uint32_t const xStep = view->checkerboard != 0 ? 2 : 1;
+
+    for (uint32_t y = y0; y < y1; ++y)
+    {
+        uint32_t const xFirst = view->checkerboard != 0 ? x0 + ((x0 + y + view->checkerboard - 1) & 1) : x0;
+        Vec3 *const row = view->pixels + (size_t)(y - firstRow) * view->width;
+
+        for (uint32_t x = xFirst; x < x1; x += xStep)
+        {
+            row[x] = scene_render_pixel(scene, view, spheres, sphereCount, x, y);
+        }
+    }
+}
+
+static void scene_render_view_tile(Scene const *const scene, RenderView const *const view, uint32_t tileIndex)
+{
+    uint32_t const tileCountX = (view->width + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t const x0 = (tileIndex % tileCountX) * TILE_SIZE;
+    uint32_t const y0 = (tileIndex / tileCountX) * TILE_SIZE;
+    uint32_t const x1 = x0 + TILE_SIZE < view->width ? x0 + TILE_SIZE : view->width;
+    uint32_t const y1 = y0 + TILE_SIZE < view->height ? y0 + TILE_SIZE : view->height;
+
+    scene_render_view_rect(scene, view, x0, y0, x1, y1, 0);
+}
+
+static void frame_reconstruct_checkerboard(Frame *const frame, uint8_t checkerboard)
+{
+    // Every untraced pixel has traced direct neighbours. It is interpolated along the direction with the smaller
+    // difference, so edges stay sharp, and blended with its previous value clamped to the neighbourhood, which
+    // rejects stale history after motion.
+    for (uint32_t y = 0; y < FRAME_HEIGHT; ++y)
+    {
+        for (uint32_t x = ((y + checkerboard) & 1); x < FRAME_WIDTH; x += 2)
+        {
+            Vec3 *const pixel = &(frame->data[y * FRAME_WIDTH + x]);
+
+            Vec3 const left = frame->data[y * FRAME_WIDTH + (x > 0 ? x - 1 : x + 1)];
+            Vec3 const right = frame->data[y * FRAME_WIDTH + (x + 1 < FRAME_WIDTH ? x + 1 : x - 1)];
+            Vec3 const down = frame->data[(y > 0 ? y - 1 : y + 1) * FRAME_WIDTH + x];
+            Vec3 const up = frame->data[(y + 1 < FRAME_HEIGHT ? y + 1 : y - 1) * FRAME_WIDTH + x];
+
+            float const horizontalDiff = vec3_length_sqr(vec3_sub(left, right));
+            float const verticalDiff = vec3_length_sqr(vec3_sub(down, up));
+
+            Vec3 interpolated;
+            if (horizontalDiff < 0.5f * verticalDiff) {
+                interpolated = vec3_lerp(left, right, 0.5f);
+            } else if (verticalDiff < 0.5f * horizontalDiff) {
+                interpolated = vec3_lerp(down, up, 0.5f);
+            } else {
+                interpolated = vec3_scale(0.25f, vec3_add(vec3_add(left, right), vec3_add(down, up)));
+            }
+
+            Vec3 history;
+            for (uint8_t c = 0; c < 3; ++c)
+            {
+                float const lowerBound = fminf(fminf(left.v[c], right.v[c]), fminf(down.v[c], up.v[c]));
+                float const upperBound = fmaxf(fmaxf(left.v[c], right.v[c]), fmaxf(down.v[c], up.v[c]));
+                history.v[c] = clamp(pixel->v[c], lowerBound, upperBound);
+            }
+
+            *pixel = vec3_lerp(interpolated, history, 0.5f);
+        }
+    }
+}
+
+static void scene_render_tile(Scene const *const scene, Frame *const frame, uint32_t tileIndex)
+{
+    RenderView const view = renderview_from_frame(scene, frame);
+
+    scene_render_view_tile(scene, &view, tileIndex);
+}
+
+float scene_render(Scene const *const scene, Frame *const frame)
+{
+    clock_t const start = clock();
+
+    for (uint32_t tile = 0; tile < FRAME_TILE_COUNT; ++tile)
+    {
+        scene_render_tile(scene, frame, tile);
+    }
+
+    // Returns the frame time in seconds.
+    return (float)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+#ifdef TRAYRACING_POSIX
+
+typedef struct SharedTileQueue {
+    uint32_t nextTile;
+    uint8_t done[FRAME_TILE_COUNT];
+} SharedTileQueue;
+
+// Seconds since some unspecified point, a float would stop resolving milliseconds after a day and a half of uptime.
+// Only differences of two wall times are meant to be narrowed to float.
+static inline double wall_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+SharedFrame frame_create_shared(void)
+{
+    SharedFrame shared;
+
+    void *const mapping = mmap(NULL, sizeof(Frame), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    shared.frame = mapping == MAP_FAILED ? NULL : (Frame *)mapping;
+
+    return shared;
+}
+
+void frame_destroy_shared(SharedFrame *const shared)
+{
+    if (shared->frame != NULL) {
+        munmap(shared->frame, sizeof(Frame));
+    }
+    shared->frame = NULL;
+}
+
+static inline Frame *framering_slot(FrameRing const *const ring, uint64_t sequence)
+{
+    FrameRingHeader *const header = ring->header;
+
+    return (Frame *)(void *)((uint8_t *)header + header->slotOffset + (size_t)(sequence % header->slotCount) * header->slotSize);
+}
+
+// Creates the ring name, a shared memory object like "/trayracing", replacing any ring left behind by an earlier run.
+// More slots give consumers more time to read a frame before the renderer comes back around to its slot.
+int framering_create(FrameRing *const ring, char const *name, uint32_t slotCount)
+{
+    if (slotCount < 2 || slotCount > FRAME_RING_MAX_SLOTS || strlen(name) >= FRAME_RING_MAX_NAME) {
+        return -1;
+    }
+
+    size_t const size = FRAME_RING_HEADER_SIZE + (size_t)slotCount * sizeof(Frame);
+
+    shm_unlink(name);
+    int const fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)size) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    void *const mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return -1;
+    }
+
+    FrameRingHeader *const header = (FrameRingHeader *)mapping;
+    header->width = FRAME_WIDTH;
+    header->height = FRAME_HEIGHT;
+    header->format = sizeof(Vec3) == 4 * sizeof(float) ? FPF_RGBX32F : FPF_RGB32F;
+    header->slotCount = slotCount;
+    header->slotOffset = FRAME_RING_HEADER_SIZE;
+    header->slotSize = sizeof(Frame);
+    // Consumers check the magic last, the rest of the header is complete by then.
+    __atomic_store_n(&header->magic, FRAME_RING_MAGIC, __ATOMIC_RELEASE);
+
+    ring->header = header;
+    ring->size = size;
+    ring->sequence = 0;
+    ring->owner = 1;
+    strcpy(ring->name, name);
+
+    return 0;
+}
+
+// Maps a ring created by another process read-only. Fails unless its frames are laid out like the Frame of this build.
+int framering_open(FrameRing *const ring, char const *name)
+{
+    if (strlen(name) >= FRAME_RING_MAX_NAME) {
+        return -1;
+    }
+
+    int const fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < FRAME_RING_HEADER_SIZE)
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t const size = (size_t)info.st_size;
+    void *const mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+
+    FrameRingHeader *const header = (FrameRingHeader *)mapping;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != FRAME_RING_MAGIC ||
+        header->width != FRAME_WIDTH || header->height != FRAME_HEIGHT || header->slotSize != sizeof(Frame) ||
+        header->format != (sizeof(Vec3) == 4 * sizeof(float) ? FPF_RGBX32F : FPF_RGB32F) ||
+        header->slotCount < 2 || header->slotCount > FRAME_RING_MAX_SLOTS ||
+        header->slotOffset + (size_t)header->slotCount * header->slotSize > size)
+    {
+        munmap(mapping, size);
+        return -1;
+    }
+
+    ring->header = header;
+    ring->size = size;
+    ring->sequence = 0;
+    ring->owner = 0;
+    strcpy(ring->name, name);
+
+    return 0;
+}
+
+// The renderer also removes the name, consumers still holding a mapping keep it until they close theirs.
+void framering_close(FrameRing *const ring)
+{
+    munmap(ring->header, ring->size);
+    if (ring->owner) {
+        shm_unlink(ring->name);
+    }
+    ring->header = NULL;
+}
+
+// The slot of the next frame, render straight into it and call framering_publish once it is complete. Never waits
+// for consumers, a frame still being read is simply overwritten and the consumer notices with framering_check.
+Frame *framering_begin(FrameRing *const ring)
+{
+    uint64_t const sequence = ++ring->sequence;
+    uint64_t *const slotSequence = &(ring->header->slotSequence[sequence % ring->header->slotCount]);
+
+    __atomic_store_n(slotSequence, 2 * sequence - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    return framering_slot(ring, sequence);
+}
+
+void framering_publish(FrameRing *const ring)
+{
+    uint64_t const sequence = ring->sequence;
+    FrameRingHeader *const header = ring->header;
+
+    __atomic_store_n(&(header->slotSequence[sequence % header->slotCount]), 2 * sequence, __ATOMIC_RELEASE);
+    __atomic_store_n(&(header->latest), sequence, __ATOMIC_RELEASE);
+}
+
+// The newest complete frame, read in place. NULL when there is none yet or the renderer just started overwriting it,
+// try again then. Once done reading, framering_check tells whether the frame stayed intact meanwhile.
+Frame const *framering_acquire(FrameRing const *const ring, uint64_t *const sequence)
+{
+    FrameRingHeader const *const header = ring->header;
+    uint64_t const latest = __atomic_load_n(&(header->latest), __ATOMIC_ACQUIRE);
+    if (latest == 0) {
+        return NULL;
+    }
+    if (__atomic_load_n(&(header->slotSequence[latest % header->slotCount]), __ATOMIC_ACQUIRE) != 2 * latest) {
+        return NULL;
+    }
+
+    *sequence = latest;
+
+    return framering_slot(ring, latest);
+}
+
+int framering_check(FrameRing const *const ring, uint64_t sequence)
+{
+    FrameRingHeader const *const header = ring->header;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&(header->slotSequence[sequence % header->slotCount]), __ATOMIC_RELAXED) == 2 * sequence;
+}
+
+float scene_render_multiprocess(Scene const *const scene, SharedFrame const *const shared, uint32_t workerCount)
+{
+    // The scene is inherited copy-on-write by fork and is only ever read by the workers, the frame is the one thing
+    // they write, which is why it has to be shared.
+    double const start = wall_time();
+
+    Frame *const frame = shared->frame;
+    if (frame == NULL) {
+        return 0.0f;
+    }
+
+    SharedTileQueue *const queue = (SharedTileQueue *)mmap(NULL, sizeof(SharedTileQueue), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (queue == MAP_FAILED) {
+        scene_render(scene, frame);
+        return (float)(wall_time() - start);
+    }
+    queue->nextTile = 0;
+    for (uint32_t tile = 0; tile < FRAME_TILE_COUNT; ++tile)
+    {
+        queue->done[tile] = 0;
+    }
+
+    fflush(NULL);
+
+    pid_t workers[MAX_WORKER_COUNT];
+    uint32_t startedWorkerCount = 0;
+
+    for (uint32_t worker = 0; worker < workerCount && worker < MAX_WORKER_COUNT; ++worker)
+    {
+        pid_t const pid = fork();
+        if (pid == 0)
+        {
+            uint32_t tile;
+            while ((tile = __atomic_fetch_add(&queue->nextTile, 1, __ATOMIC_RELAXED)) < FRAME_TILE_COUNT)
+            {
+                scene_render_tile(scene, frame, tile);
+                __atomic_store_n(&queue->done[tile], 1, __ATOMIC_RELEASE);
+            }
+            _exit(0);
+        }
+        if (pid < 0) {
+            break;
+        }
+        workers[startedWorkerCount++] = pid;
+    }
+
+    for (uint32_t worker = 0; worker < startedWorkerCount; ++worker)
+    {
+        waitpid(workers[worker], NULL, 0);
+    }
+
+    // Tiles of crashed workers, or every tile if no worker could be started, are rendered here.
+    for (uint32_t tile = 0; tile < FRAME_TILE_COUNT; ++tile)
+    {
+        if (!__atomic_load_n(&queue->done[tile], __ATOMIC_ACQUIRE)) {
+            scene_render_tile(scene, frame, tile);
+        }
+    }
+
+    munmap(queue, sizeof(SharedTileQueue));
+
+    // Returns the frame time in seconds.
+    return (float)(wall_time() - start);
+}
+
+typedef struct RenderDaemon {
+    int listenFd;
+    int stopping;
+    Scene const *scenes;
+    uint32_t sceneCount;
+    pthread_mutex_t mutex;
+    int clients[MAX_WORKER_COUNT]; // Connections being served, one per worker, -1 in the unused slots.
+} RenderDaemon;
+
+static int socket_read_all(int fd, void *data, size_t size)
+{
+    uint8_t *bytes = (uint8_t *)data;
+
+    while (size > 0)
+    {
+        ssize_t const count = recv(fd, bytes, size, 0);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return -1;
+        }
+        bytes += count;
+        size -= (size_t)count;
+    }
+
+    return 0;
+}
+
+static int socket_write_all(int fd, void const *data, size_t size)
+{
+    uint8_t const *bytes = (uint8_t const *)data;
+
+    while (size > 0)
+    {
+        ssize_t const count = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return -1;
+        }
+        bytes += count;
+        size -= (size_t)count;
+    }
+
+    return 0;
+}
+
+static int socket_connect_unix(char const *socketPath)
+{
+    struct sockaddr_un address;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath);
+
+    int const fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr const *)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static inline uint8_t *wire_put_u32(uint8_t *bytes, uint32_t v)
+{
+    memcpy(bytes, &v, sizeof(v));
+    return bytes + sizeof(v);
+}
+
+static inline uint8_t *wire_put_vec3(uint8_t *bytes, Vec3 v)
+{
+    memcpy(bytes, v.v, 3 * sizeof(float));
+    return bytes + 3 * sizeof(float);
+}
+
+static inline uint8_t const *wire_get_u32(uint8_t const *bytes, uint32_t *const v)
+{
+    memcpy(v, bytes, sizeof(*v));
+    return bytes + sizeof(*v);
+}
+
+static inline uint8_t const *wire_get_vec3(uint8_t const *bytes, Vec3 *const v)
+{
+    *v = vec3_zero();
+    memcpy(v->v, bytes, 3 * sizeof(float));
+    return bytes + 3 * sizeof(float);
+}
+
+static int renderrequest_write(int fd, RenderRequest const *const request)
+{
+    uint8_t bytes[DAEMON_REQUEST_SIZE];
+    uint8_t *it = bytes;
+
+    it = wire_put_u32(it, request->type);
+    it = wire_put_u32(it, request->sceneIndex);
+    it = wire_put_vec3(it, request->camera.eye);
+    it = wire_put_vec3(it, request->camera.lookat);
+    it = wire_put_vec3(it, request->camera.right);
+    it = wire_put_vec3(it, request->camera.up);
+    it = wire_put_u32(it, request->width);
+    it = wire_put_u32(it, request->height);
+    wire_put_u32(it, request->samplesPerPixel);
+
+    return socket_write_all(fd, bytes, sizeof(bytes));
+}
+
+static int renderrequest_read(int fd, RenderRequest *const request)
+{
+    uint8_t bytes[DAEMON_REQUEST_SIZE];
+    if (socket_read_all(fd, bytes, sizeof(bytes)) != 0) {
+        return -1;
+    }
+
+    uint8_t const *it = bytes;
+    it = wire_get_u32(it, &request->type);
+    it = wire_get_u32(it, &request->sceneIndex);
+    it = wire_get_vec3(it, &request->camera.eye);
+    it = wire_get_vec3(it, &request->camera.lookat);
+    it = wire_get_vec3(it, &request->camera.right);
+    it = wire_get_vec3(it, &request->camera.up);
+    it = wire_get_u32(it, &request->width);
+    it = wire_get_u32(it, &request->height);
+    wire_get_u32(it, &request->samplesPerPixel);
+
+    return 0;
+}
+
+static int renderresponse_write(int fd, RenderResponse const *const response)
+{
+    uint8_t bytes[DAEMON_RESPONSE_SIZE];
+    uint8_t *it = bytes;
+
+    it = wire_put_u32(it, response->status);
+    it = wire_put_u32(it, response->width);
+    wire_put_u32(it, response->height);
+
+    return socket_write_all(fd, bytes, sizeof(bytes));
+}
+
+static int renderresponse_read(int fd, RenderResponse *const response)
+{
+    uint8_t bytes[DAEMON_RESPONSE_SIZE];
+    if (socket_read_all(fd, bytes, sizeof(bytes)) != 0) {
+        return -1;
+    }
+
+    uint8_t const *it = bytes;
+    it = wire_get_u32(it, &response->status);
+    it = wire_get_u32(it, &response->width);
+    wire_get_u32(it, &response->height);
+
+    return 0;
+}
+
+// Pixels go over the socket as three floats each, converted in chunks like the bands of scene_render_to_file.
+static int pixels_write(int fd, Vec3 const *pixels, size_t count)
+{
+    uint8_t bytes[3 * sizeof(float) * STREAM_CHUNK_SIZE];
+
+    for (size_t i = 0; i < count; i += STREAM_CHUNK_SIZE)
+    {
+        size_t const chunk = count - i < STREAM_CHUNK_SIZE ? count - i : STREAM_CHUNK_SIZE;
+        uint8_t *it = bytes;
+        for (size_t j = 0; j < chunk; ++j)
+        {
+            it = wire_put_vec3(it, pixels[i + j]);
+        }
+        if (socket_write_all(fd, bytes, (size_t)(it - bytes)) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int pixels_read(int fd, Vec3 *const pixels, size_t count)
+{
+    uint8_t bytes[3 * sizeof(float) * STREAM_CHUNK_SIZE];
+
+    for (size_t i = 0; i < count; i += STREAM_CHUNK_SIZE)
+    {
+        size_t const chunk = count - i < STREAM_CHUNK_SIZE ? count - i : STREAM_CHUNK_SIZE;
+        if (socket_read_all(fd, bytes, 3 * sizeof(float) * chunk) != 0) {
+            return -1;
+        }
+        uint8_t const *it = bytes;
+        for (size_t j = 0; j < chunk; ++j)
+        {
+            it = wire_get_vec3(it, &pixels[i + j]);
+        }
+    }
+
+    return 0;
+}
+
+// Returns the slot of the connection, or -1 when the daemon is already stopping and the connection must be dropped.
+static int renderdaemon_attach_client(RenderDaemon *const daemon, int client)
+{
+    int slot = -1;
+
+    pthread_mutex_lock(&daemon->mutex);
+    if (!daemon->stopping)
+    {
+        for (int i = 0; i < MAX_WORKER_COUNT && slot < 0; ++i)
+        {
+            if (daemon->clients[i] < 0)
+            {
+                daemon->clients[i] = client;
+                slot = i;
+            }
+        }
+    }
+    pthread_mutex_unlock(&daemon->mutex);
+
+    return slot;
+}
+
+static void renderdaemon_detach_client(RenderDaemon *const daemon, int slot)
+{
+    pthread_mutex_lock(&daemon->mutex);
+    daemon->clients[slot] = -1;
+    pthread_mutex_unlock(&daemon->mutex);
+}
+
+// Wakes every worker: those waiting in accept as well as those waiting for the next request of an open connection.
+static void renderdaemon_shutdown(RenderDaemon *const daemon)
+{
+    pthread_mutex_lock(&daemon->mutex);
+    __atomic_store_n(&daemon->stopping, 1, __ATOMIC_RELEASE);
+    shutdown(daemon->listenFd, SHUT_RDWR);
+    for (int i = 0; i < MAX_WORKER_COUNT; ++i)
+    {
+        if (daemon->clients[i] >= 0) {
+            shutdown(daemon->clients[i], SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&daemon->mutex);
+}
+
+static void renderdaemon_serve_client(RenderDaemon *const daemon, int client, Vec3 **pixels, size_t *pixelCapacity)
+{
+    RenderRequest request;
+
+    // Requests on one connection are answered in order, so a client may pipeline several before reading.
+    while (renderrequest_read(client, &request) == 0)
+    {
+        if (request.type == RRT_SHUTDOWN)
+        {
+            renderdaemon_shutdown(daemon);
+            return;
+        }
+
+        RenderResponse response = {RS_OK, request.width, request.height};
+        size_t const pixelCount = (size_t)request.width * request.height;
+
+        if (request.type != RRT_RENDER || request.sceneIndex >= daemon->sceneCount ||
+            request.width == 0 || request.height == 0 || request.width > MAX_DAEMON_RESOLUTION || request.height > MAX_DAEMON_RESOLUTION ||
+            request.samplesPerPixel == 0 || request.samplesPerPixel > MAX_DAEMON_SAMPLES)
+        {
+            response.status = RS_INVALID_REQUEST;
+        }
+        else if (pixelCount > *pixelCapacity)
+        {
+            Vec3 *const grown = (Vec3 *)realloc(*pixels, pixelCount * sizeof(Vec3));
+            if (grown == NULL) {
+                response.status = RS_OUT_OF_MEMORY;
+            } else {
+                *pixels = grown;
+                *pixelCapacity = pixelCount;
+            }
+        }
+
+        if (response.status != RS_OK)
+        {
+            response.width = 0;
+            response.height = 0;
+            if (renderresponse_write(client, &response) != 0) {
+                return;
+            }
+            continue;
+        }
+
+        Scene const *const scene = &(daemon->scenes[request.sceneIndex]);
+        RenderView const view = {&(request.camera), *pixels, request.width, request.height, request.samplesPerPixel, MAX_RAY_DEPTH, 0, NULL};
+
+        RenderJob job;
+        scene_render_view_async(&job, scene, &view, NULL, NULL);
+        renderjob_wait(&job);
+
+        if (renderresponse_write(client, &response) != 0 || pixels_write(client, *pixels, pixelCount) != 0)
+        {
+            return;
+        }
+    }
+}
+
+static void *renderdaemon_worker(void *arg)
+{
+    RenderDaemon *const daemon = (RenderDaemon *)arg;
+
+    Vec3 *pixels = NULL;
+    size_t pixelCapacity = 0;
+
+    // Every connection thread accepts on the shared socket, the frames of concurrent clients queue up on the pool.
+    while (!__atomic_load_n(&daemon->stopping, __ATOMIC_ACQUIRE))
+    {
+        int const client = accept(daemon->listenFd, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+
+        int const slot = renderdaemon_attach_client(daemon, client);
+        if (slot >= 0)
+        {
+            renderdaemon_serve_client(daemon, client, &pixels, &pixelCapacity);
+            renderdaemon_detach_client(daemon, slot);
+        }
+        close(client);
+    }
+
+    free(pixels);
+
+    return NULL;
+}
+
+int renderdaemon_run(char const *socketPath, Scene const *scenes, uint32_t sceneCount, uint32_t workerCount)
+{
+    struct sockaddr_un address;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath);
+
+    RenderDaemon daemon;
+    daemon.stopping = 0;
+    daemon.scenes = scenes;
+    daemon.sceneCount = sceneCount;
+    for (uint32_t i = 0; i < MAX_WORKER_COUNT; ++i)
+    {
+        daemon.clients[i] = -1;
+    }
+    daemon.listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (daemon.listenFd < 0) {
+        return -1;
+    }
+
+    unlink(socketPath);
+    if (bind(daemon.listenFd, (struct sockaddr const *)&address, sizeof(address)) < 0 || listen(daemon.listenFd, SOMAXCONN) < 0)
+    {
+        close(daemon.listenFd);
+        return -1;
+    }
+    pthread_mutex_init(&daemon.mutex, NULL);
+
+    pthread_t workers[MAX_WORKER_COUNT];
+    uint32_t startedWorkerCount = 0;
+
+    workerCount = workerCount < 1 ? 1 : workerCount > MAX_WORKER_COUNT ? MAX_WORKER_COUNT : workerCount;
+    for (uint32_t worker = 0; worker < workerCount; ++worker)
+    {
+        if (pthread_create(&workers[startedWorkerCount], NULL, renderdaemon_worker, &daemon) == 0) {
+            ++startedWorkerCount;
+        }
+    }
+
+    for (uint32_t worker = 0; worker < startedWorkerCount; ++worker)
+    {
+        pthread_join(workers[worker], NULL);
+    }
+
+    pthread_mutex_destroy(&daemon.mutex);
+    close(daemon.listenFd);
+    unlink(socketPath);
+
+    return startedWorkerCount > 0 ? 0 : -1;
+}
+
+int renderdaemon_request(char const *socketPath, RenderRequest const *requests, Vec3 *const *pixels, uint32_t count)
+{
+    int const fd = socket_connect_unix(socketPath);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // All requests are sent up front and the responses are read back in order.
+    int result = 0;
+    for (uint32_t i = 0; i < count && result == 0; ++i)
+    {
+        result = renderrequest_write(fd, &requests[i]);
+    }
+
+    for (uint32_t i = 0; i < count && result == 0; ++i)
+    {
+        RenderResponse response;
+
+        // Pixels are only read into a buffer of the size the caller asked for.
+        if (renderresponse_read(fd, &response) != 0 || response.status != RS_OK ||
+            response.width != requests[i].width || response.height != requests[i].height)
+        {
+            result = -1;
+            break;
+        }
+        result = pixels_read(fd, pixels[i], (size_t)response.width * response.height);
+    }
+
+    close(fd);
+
+    return result;
+}
+
+int renderdaemon_stop(char const *socketPath)
+{
+    int const fd = socket_connect_unix(socketPath);
+    if (fd < 0) {
+        return -1;
+    }
+
+    RenderRequest request;
+    memset(&request, 0, sizeof(request));
+    request.type = RRT_SHUTDOWN;
+
+    int const result = renderrequest_write(fd, &request);
+
+    close(fd);
+
+    return result;
+}
+
+#ifndef TRAYRACING_THREAD_COUNT
+#define TRAYRACING_THREAD_COUNT 0
+#endif
+
+typedef struct ThreadPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    RenderJob *head;
+    RenderJob *tail;
+    uint32_t threadCount;
+    pthread_t threads[MAX_WORKER_COUNT];
+} ThreadPool;
+
+static ThreadPool threadpool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, {0}};
+static pthread_once_t threadpoolOnce = PTHREAD_ONCE_INIT;
+
+static void renderjob_finish_tiles(RenderJob *const job, uint32_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    // Read before finishing, once the last tile is in the job may be waited for and reused.
+    uint32_t const tileCount = job->tileCount;
+    if (__atomic_add_fetch(&job->finishedTiles, count, __ATOMIC_ACQ_REL) == tileCount)
+    {
+        pthread_mutex_lock(&job->mutex);
+        job->frameTime = (float)(wall_time() - job->startTime);
+        __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&job->finished);
+        pthread_mutex_unlock(&job->mutex);
+    }
+}
+
+static void renderjob_run_tile(RenderJob *const job, uint32_t tile)
+{
+    if (job->task != NULL)
+    {
+        job->task(job->taskContext, tile);
+    }
+    else if (!__atomic_load_n(&job->cancelled, __ATOMIC_ACQUIRE))
+    {
+        RenderView const *const view = &(job->view);
+        scene_render_view_tile(job->scene, view, tile);
+
+        if (job->onTileDone != NULL)
+        {
+            uint32_t const tileCountX = (view->width + TILE_SIZE - 1) / TILE_SIZE;
+            uint32_t const x0 = (tile % tileCountX) * TILE_SIZE;
+            uint32_t const y0 = (tile / tileCountX) * TILE_SIZE;
+            uint32_t const x1 = x0 + TILE_SIZE < view->width ? x0 + TILE_SIZE : view->width;
+            uint32_t const y1 = y0 + TILE_SIZE < view->height ? y0 + TILE_SIZE : view->height;
+
+            job->onTileDone(job->userData, x0, y0, x1, y1);
+        }
+    }
+
+    renderjob_finish_tiles(job, 1);
+}
+
+// Must be called with the pool mutex held.
+static void threadpool_remove_job(RenderJob *const job)
+{
+    RenderJob *previous = NULL;
+
+    for (RenderJob *it = threadpool.head; it != NULL; previous = it, it = it->next)
+    {
+        if (it == job)
+        {
+            if (previous == NULL) {
+                threadpool.head = job->next;
+            } else {
+                previous->next = job->next;
+            }
+            if (threadpool.tail == job) {
+                threadpool.tail = previous;
+            }
+            job->next = NULL;
+            return;
+        }
+    }
+}
+
+static void *threadpool_worker(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&threadpool.mutex);
+    for (;;)
+    {
+        while (threadpool.head == NULL)
+        {
+            pthread_cond_wait(&threadpool.wake, &threadpool.mutex);
+        }
+
+        // Jobs are served in submission order, a job leaves the queue once its last tile is taken.
+        RenderJob *const job = threadpool.head;
+        uint32_t const tile = job->nextTile++;
+        if (job->nextTile == job->tileCount) {
+            threadpool_remove_job(job);
+        }
+        pthread_mutex_unlock(&threadpool.mutex);
+
+        renderjob_run_tile(job, tile);
+
+        pthread_mutex_lock(&threadpool.mutex);
+    }
+
+    return NULL;
+}
+
+static void threadpool_start(void)
+{
+    long threadCount = TRAYRACING_THREAD_COUNT;
+    if (threadCount <= 0) {
+        threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    threadCount = threadCount < 1 ? 1 : threadCount > MAX_WORKER_COUNT ? MAX_WORKER_COUNT : threadCount;
+
+    for (long i = 0; i < threadCount; ++i)
+    {
+        if (pthread_create(&threadpool.threads[threadpool.threadCount], NULL, threadpool_worker, NULL) == 0) {
+            ++threadpool.threadCount;
+        }
+    }
+}
+
+static void renderjob_submit(RenderJob *const job, uint32_t tileCount)
+{
+    pthread_once(&threadpoolOnce, threadpool_start);
+
+    job->tileCount = tileCount;
+    job->nextTile = 0;
+    job->finishedTiles = 0;
+    job->cancelled = 0;
+    job->done = 0;
+    job->startTime = wall_time();
+    job->frameTime = 0.0f;
+    job->next = NULL;
+    pthread_mutex_init(&job->mutex, NULL);
+    pthread_cond_init(&job->finished, NULL);
+
+    if (tileCount == 0)
+    {
+        job->done = 1;
+        return;
+    }
+
+    if (threadpool.threadCount == 0)
+    {
+        // No worker could be started, render synchronously so the job still completes.
+        for (uint32_t tile = 0; tile < job->tileCount; ++tile)
+        {
+            job->nextTile = tile + 1;
+            renderjob_run_tile(job, tile);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&threadpool.mutex);
+    if (threadpool.tail == NULL) {
+        threadpool.head = job;
+    } else {
+        threadpool.tail->next = job;
+    }
+    threadpool.tail = job;
+    pthread_cond_broadcast(&threadpool.wake);
+    pthread_mutex_unlock(&threadpool.mutex);
+}
+
+void scene_render_view_async(RenderJob *const job, Scene const *const scene, RenderView const *const view, RenderTileCallback onTileDone, void *userData)
+{
+    job->scene = scene;
+    job->view = *view;
+    job->onTileDone = onTileDone;
+    job->userData = userData;
+    job->task = NULL;
+    job->taskContext = NULL;
+
+    renderjob_submit(job, renderview_tile_count(view));
+}
+
+// Runs task(context, 0) ... task(context, count - 1) on the worker pool and blocks until all of them returned.
+static void threadpool_run(uint32_t count, void (*task)(void *context, uint32_t index), void *context)
+{
+    RenderJob job;
+
+    job.scene = NULL;
+    job.onTileDone = NULL;
+    job.userData = NULL;
+    job.task = task;
+    job.taskContext = context;
+
+    renderjob_submit(&job, count);
+    renderjob_wait(&job);
+}
+
+void scene_render_async(RenderJob *const job, Scene const *const scene, Frame *const frame, RenderTileCallback onTileDone, void *userData)
+{
+    RenderView const view = renderview_from_frame(scene, frame);
+
+    scene_render_view_async(job, scene, &view, onTileDone, userData);
+}
+
+int renderjob_poll(RenderJob *const job)
+{
+    return __atomic_load_n(&job->done, __ATOMIC_ACQUIRE);
+}
+
+float renderjob_wait(RenderJob *const job)
+{
+    pthread_mutex_lock(&job->mutex);
+    while (!job->done)
+    {
+        pthread_cond_wait(&job->finished, &job->mutex);
+    }
+    pthread_mutex_unlock(&job->mutex);
+
+    pthread_cond_destroy(&job->finished);
+    pthread_mutex_destroy(&job->mutex);
+
+    // Returns the frame time in seconds.
+    return job->frameTime;
+}
+
+void renderjob_cancel(RenderJob *const job)
+{
+    __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELEASE);
+
+    // Tiles nobody has taken yet are accounted for here, tiles in flight finish on their worker.
+    pthread_mutex_lock(&threadpool.mutex);
+    uint32_t const skippedTiles = job->tileCount - job->nextTile;
+    job->nextTile = job->tileCount;
+    threadpool_remove_job(job);
+    pthread_mutex_unlock(&threadpool.mutex);
+
+    renderjob_finish_tiles(job, skippedTiles);
+}
+
+#else
+
+static void threadpool_run(uint32_t count, void (*task)(void *context, uint32_t index), void *context)
+{
+    for (uint32_t index = 0; index < count; ++index)
+    {
+        task(context, index);
+    }
+}
+
+#endif
+
+// Renders the view on the worker pool where there is one and returns the frame time in seconds.
+static float scene_render_view(Scene const *const scene, RenderView const *const view)
+{
+#ifdef TRAYRACING_POSIX
+    double const start = wall_time();
+
+    RenderJob job;
+    scene_render_view_async(&job, scene, view, NULL, NULL);
+    renderjob_wait(&job);
+
+    return (float)(wall_time() - start);
+#else
+    clock_t const start = clock();
+
+    for (uint32_t tile = 0, tileCount = renderview_tile_count(view); tile < tileCount; ++tile)
+    {
+        scene_render_view_tile(scene, view, tile);
+    }
+
+    return (float)(clock() - start) / CLOCKS_PER_SEC;
+#endif
+}
+
+// Views rendered together, either given as they are or as cameras each rendered into its own frame.
+typedef struct ViewBatch {
+    Scene const *scene;
+    RenderView const *views;
+    Camera const *cameras;
+    Frame *frames;
+    uint32_t viewCount;
+} ViewBatch;
+
+static inline RenderView viewbatch_view(ViewBatch const *const batch, uint32_t index)
+{
+    if (batch->views != NULL) {
+        return batch->views[index];
+    }
+
+    RenderView view = renderview_from_frame(batch->scene, &(batch->frames[index]));
+    view.camera = &(batch->cameras[index]);
+
+    return view;
+}
+
+static void viewbatch_render_tile(void *context, uint32_t tileIndex)
+{
+    ViewBatch const *const batch = (ViewBatch const *)context;
+
+    for (uint32_t i = 0; i < batch->viewCount; ++i)
+    {
+        RenderView const view = viewbatch_view(batch, i);
+        uint32_t const tileCount = renderview_tile_count(&view);
+
+        if (tileIndex < tileCount)
+        {
+            scene_render_view_tile(batch->scene, &view, tileIndex);
+            return;
+        }
+        tileIndex -= tileCount;
+    }
+}
+
+// The tiles of all views go to the worker pool as one job, so workers carry on with the next view instead of
+// waiting at the end of each, and the pool is woken and joined once per batch.
+static float viewbatch_render(ViewBatch const *const batch)
+{
+    uint32_t tileCount = 0;
+    for (uint32_t i = 0; i < batch->viewCount; ++i)
+    {
+        RenderView const view = viewbatch_view(batch, i);
+        tileCount += renderview_tile_count(&view);
+    }
+
+#ifdef TRAYRACING_POSIX
+    double const start = wall_time();
+
+    threadpool_run(tileCount, viewbatch_render_tile, (void *)batch);
+
+    return (float)(wall_time() - start);
+#else
+    clock_t const start = clock();
+
+    threadpool_run(tileCount, viewbatch_render_tile, (void *)batch);
+
+    return (float)(clock() - start) / CLOCKS_PER_SEC;
+#endif
+}
+
+// Renders the same scene from many views, stereo pairs, cubemap faces or turntables, in one call. Returns the time of
+// the whole batch in seconds.
+float scene_render_views(Scene const *const scene, RenderView const *views, uint32_t viewCount)
+{
+    ViewBatch const batch = {scene, views, NULL, NULL, viewCount};
+
+    return viewbatch_render(&batch);
+}
+
+// Renders frames[i] from cameras[i] at the frame resolution.
+float scene_render_batch(Scene const *const scene, Camera const *cameras, Frame *const frames, uint32_t count)
+{
+    ViewBatch const batch = {scene, NULL, cameras, frames, count};
+
+    return viewbatch_render(&batch);
+}
+
+float scene_render_scaled(Scene const *const scene, RenderSettings const *const settings, Vec3 *const scratch, Frame *const frame)
+{
+    // Reduced resolutions are rendered into the scratch buffer and upscaled into the frame afterwards.
+    uint8_t const fullResolution = settings->width == FRAME_WIDTH && settings->height == FRAME_HEIGHT;
+    RenderView const view = renderview_from_settings(scene, settings, fullResolution ? frame->data : scratch);
+
+    float const frameTime = scene_render_view(scene, &view);
+
+    if (!fullResolution) {
+        frame_upscale(frame, scratch, settings->width, settings->height, 0, 0, settings->width, settings->height);
+    }
+
+    return frameTime;
+}
+
+// Rows y0 to y1 of the image of the view, stored in the pixels of the view.
+typedef struct RenderBand {
+    Scene const *scene;
+    RenderView view;
+    uint32_t y0;
+    uint32_t y1;
+} RenderBand;
+
+// Bands are counted from the top of the image, the order its rows are stored in files.
+static void renderband_place(RenderBand *const band, uint32_t index, uint32_t bandHeight)
+{
+    band->y1 = band->view.height - index * bandHeight;
+    band->y0 = band->y1 > bandHeight ? band->y1 - bandHeight : 0;
+}
+
+static inline uint32_t renderband_tile_count(RenderBand const *const band)
+{
+    return ((band->view.width + TILE_SIZE - 1) / TILE_SIZE) * ((band->y1 - band->y0 + TILE_SIZE - 1) / TILE_SIZE);
+}
+
+static void renderband_render_tile(void *context, uint32_t tileIndex)
+{
+    RenderBand const *const band = (RenderBand const *)context;
+    uint32_t const tileCountX = (band->view.width + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t const x0 = (tileIndex % tileCountX) * TILE_SIZE;
+    uint32_t const y0 = band->y0 + (tileIndex / tileCountX) * TILE_SIZE;
+    uint32_t const x1 = x0 + TILE_SIZE < band->view.width ? x0 + TILE_SIZE : band->view.width;
+    uint32_t const y1 = y0 + TILE_SIZE < band->y1 ? y0 + TILE_SIZE : band->y1;
+
+    scene_render_view_rect(band->scene, &(band->view), x0, y0, x1, y1, band->y0);
+}
+
+// Writes the rows of the band top down, converted in chunks so not even a full row of bytes is held.
+static void renderband_write(RenderBand const *const band, FILE *const file)
+{
+    uint32_t const width = band->view.width;
+    uint8_t bytes[3 * STREAM_CHUNK_SIZE];
+
+    for (uint32_t y = band->y1; y-- > band->y0;)
+    {
+        Vec3 const *const row = band->view.pixels + (size_t)(y - band->y0) * width;
+
+        for (uint32_t x = 0; x < width; x += STREAM_CHUNK_SIZE)
+        {
+            uint32_t const count = width - x < STREAM_CHUNK_SIZE ? width - x : STREAM_CHUNK_SIZE;
+            render_kernels()->convertRgb8(row + x, bytes, count);
+            fwrite(bytes, 1, 3 * count, file);
+        }
+    }
+}
+
+// Renders an image of any size into a PPM at path, band by band, so memory stays bounded by the band height rather
+// than the image size. Scratch holds two bands of settings->width * bandHeight pixels: while the workers render one
+// of them, the other is written out. Returns 0 on success and -1 when the file cannot be written.
+int scene_render_to_file(Scene const *const scene, RenderSettings const *const settings, Vec3 *const scratch, uint32_t bandHeight, char const *path)
+{
+    if (bandHeight == 0) {
+        return -1;
+    }
+
+    FILE *const file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    fprintf(file, "P6\n%u %u\n255\n", settings->width, settings->height);
+
+    size_t const bandSize = (size_t)settings->width * bandHeight;
+    RenderBand bands[2];
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        bands[i].scene = scene;
+        bands[i].view = renderview_from_settings(scene, settings, scratch + i * bandSize);
+    }
+
+    uint32_t const bandCount = (settings->height + bandHeight - 1) / bandHeight;
+
+#ifdef TRAYRACING_POSIX
+    RenderJob job;
+    RenderBand const *previous = NULL;
+
+    for (uint32_t i = 0; i < bandCount; ++i)
+    {
+        RenderBand *const band = &(bands[i & 1]);
+        renderband_place(band, i, bandHeight);
+
+        job.scene = NULL;
+        job.onTileDone = NULL;
+        job.userData = NULL;
+        job.task = renderband_render_tile;
+        job.taskContext = band;
+        renderjob_submit(&job, renderband_tile_count(band));
+
+        if (previous != NULL) {
+            renderband_write(previous, file);
+        }
+        renderjob_wait(&job);
+        previous = band;
+    }
+    if (previous != NULL) {
+        renderband_write(previous, file);
+    }
+#else
+    for (uint32_t i = 0; i < bandCount; ++i)
+    {
+        renderband_place(&(bands[0]), i, bandHeight);
+        threadpool_run(renderband_tile_count(&(bands[0])), renderband_render_tile, &(bands[0]));
+        renderband_write(&(bands[0]), file);
+    }
+#endif
+
+    int const failed = ferror(file);
+
+    return (fclose(file) == 0 && !failed) ? 0 : -1;
+}
+
+float scene_render_checkerboard(Scene const *const scene, Frame *const frame, uint32_t frameIndex)
+{
+    // Traces half of the pixels, alternating between the two checkerboard patterns from frame to frame.
+    // The frame has to hold the previous frame, its values are reused for the pixels not traced now.
+    RenderView view = renderview_from_frame(scene, frame);
+    view.checkerboard = (uint8_t)(1 + (frameIndex & 1));
+
+    float const frameTime = scene_render_view(scene, &view);
+
+    frame_reconstruct_checkerboard(frame, view.checkerboard);
+
+    return frameTime;
+}
+
+typedef struct DenoisePass {
+    float const *input[3];
+    float *output[3];
+    GBuffer const *gbuffer;
+    int32_t stepSize;
+    float invColorSigma2;
+} DenoisePass;
+
+TRAYRACING_KERNEL_INLINE void denoise_band_kernel(void *context, uint32_t band)
+{
+    DenoisePass const *const pass = (DenoisePass const *)context;
+    GBuffer const *const gbuffer = pass->gbuffer;
+
+    // B3 spline, spread over holes of stepSize - 1 pixels in every iteration of the a-trous transform.
+    static float const kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+    float const invColorSigma2 = pass->invColorSigma2;
+    float const invNormalSigma2 = 1.0f / (DENOISE_SIGMA_NORMAL * DENOISE_SIGMA_NORMAL);
+    float const invAlbedoSigma2 = 1.0f / (DENOISE_SIGMA_ALBEDO * DENOISE_SIGMA_ALBEDO);
+
+    float sumR[FRAME_WIDTH];
+    float sumG[FRAME_WIDTH];
+    float sumB[FRAME_WIDTH];
+    float sumWeight[FRAME_WIDTH];
+    float invDepthScale[FRAME_WIDTH];
+
+    uint32_t const yBegin = band * DENOISE_BAND_HEIGHT;
+    uint32_t const yEnd = yBegin + DENOISE_BAND_HEIGHT < FRAME_HEIGHT ? yBegin + DENOISE_BAND_HEIGHT : FRAME_HEIGHT;
+
+    for (uint32_t y = yBegin; y < yEnd; ++y)
+    {
+        uint32_t const row = y * FRAME_WIDTH;
+
+        for (uint32_t x = 0; x < FRAME_WIDTH; ++x)
+        {
+            sumR[x] = 0.0f;
+            sumG[x] = 0.0f;
+            sumB[x] = 0.0f;
+            sumWeight[x] = 0.0f;
+            // Depth tolerance grows with distance and with the tap spacing, so slanted surfaces are not cut apart.
+            invDepthScale[x] = 1.0f / (DENOISE_SIGMA_DEPTH * (float)pass->stepSize * (gbuffer->depth[row + x] + 1e-2f));
+        }
+
+        for (int32_t j = 0; j < 5; ++j)
+        {
+            int32_t const yy = (int32_t)y + (j - 2) * pass->stepSize;
+            if (yy < 0 || yy >= FRAME_HEIGHT) {
+                continue;
+            }
+
+            for (int32_t i = 0; i < 5; ++i)
+            {
+                // Taps outside of the frame are skipped, the weights are renormalized at the end anyway.
+                int32_t const dx = (i - 2) * pass->stepSize;
+                int32_t const xBegin = dx < 0 ? -dx : 0;
+                int32_t const xEnd = dx > 0 ? FRAME_WIDTH - dx : FRAME_WIDTH;
+                int32_t const tapRow = yy * FRAME_WIDTH + dx;
+                float const h = kernel[i] * kernel[j];
+
+                // Planar data and no branches, so the compiler turns this loop into SIMD code.
+                for (int32_t x = xBegin; x < xEnd; ++x)
+                {
+                    int32_t const c = (int32_t)row + x;
+                    int32_t const t = tapRow + x;
+
+                    float const dr = pass->input[0][t] - pass->input[0][c];
+                    float const dg = pass->input[1][t] - pass->input[1][c];
+                    float const db = pass->input[2][t] - pass->input[2][c];
+                    float const nx = gbuffer->normalX[t] - gbuffer->normalX[c];
+                    float const ny = gbuffer->normalY[t] - gbuffer->normalY[c];
+                    float const nz = gbuffer->normalZ[t] - gbuffer->normalZ[c];
+                    float const ar = gbuffer->albedoR[t] - gbuffer->albedoR[c];
+                    float const ag = gbuffer->albedoG[t] - gbuffer->albedoG[c];
+                    float const ab = gbuffer->albedoB[t] - gbuffer->albedoB[c];
+                    float const dz = fabsf(gbuffer->depth[t] - gbuffer->depth[c]) * invDepthScale[x];
+
+                    float const weight = h * expf(-((dr * dr + dg * dg + db * db) * invColorSigma2 +
+                                                    (nx * nx + ny * ny + nz * nz) * invNormalSigma2 +
+                                                    (ar * ar + ag * ag + ab * ab) * invAlbedoSigma2 +
+                                                    dz));
+
+                    sumR[x] += weight * pass->input[0][t];
+                    sumG[x] += weight * pass->input[1][t];
+                    sumB[x] += weight * pass->input[2][t];
+                    sumWeight[x] += weight;
+                }
+            }
+        }
+
+        for (uint32_t x = 0; x < FRAME_WIDTH; ++x)
+        {
+            float const invWeight = 1.0f / sumWeight[x];
+            pass->output[0][row + x] = sumR[x] * invWeight;
+            pass->output[1][row + x] = sumG[x] * invWeight;
+            pass->output[2][row + x] = sumB[x] * invWeight;
+        }
+    }
+}
+
+static void denoise_band(void *context, uint32_t band)
+{
+    denoise_band_kernel(context, band);
+}
+
+// Interleaved pixels to clamped 8-bit channels, truncated like frame_save_to_file always did.
+TRAYRACING_KERNEL_INLINE void frame_convert_rgb8_kernel(Vec3 const *pixels, uint8_t *bytes, uint32_t count)
+{
+    if (sizeof(Vec3) == 3 * sizeof(float)) {
+        // Packed pixels are a flat array of channels, which vectorizes without shuffles.
+        float const *const channels = (float const *)pixels;
+
+        for (uint32_t i = 0; i < 3 * count; ++i)
+        {
+            bytes[i] = (uint8_t)(clamp(channels[i], 0.0f, 1.0f) * 255.0f);
+        }
+    } else {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            bytes[3 * i + 0] = (uint8_t)(clamp(pixels[i].r, 0.0f, 1.0f) * 255.0f);
+            bytes[3 * i + 1] = (uint8_t)(clamp(pixels[i].g, 0.0f, 1.0f) * 255.0f);
+            bytes[3 * i + 2] = (uint8_t)(clamp(pixels[i].b, 0.0f, 1.0f) * 255.0f);
+        }
+    }
+}
+
+static void frame_convert_rgb8(Vec3 const *pixels, uint8_t *bytes, uint32_t count)
+{
+    frame_convert_rgb8_kernel(pixels, bytes, count);
+}
+
+static inline float colorpipeline_tonemap(float v, uint8_t tonemap)
+{
+    if (tonemap == TM_REINHARD) {
+        return v / (1.0f + v);
+    }
+    if (tonemap == TM_ACES) {
+        // Narkowicz's fit of the ACES filmic curve.
+        return (v * (2.51f * v + 0.03f)) / (v * (2.43f * v + 0.59f) + 0.14f);
+    }
+
+    return v;
+}
+
+static inline uint8_t colorpipeline_encode(ColorPipeline const *pipeline, float v, uint8_t tonemap, uint16_t dither)
+{
+    // The table is indexed by the square root of the tonemapped value, which spends its entries on the darks.
+    float const t = sqrtf(fminf(colorpipeline_tonemap(fmaxf(v * pipeline->scale, 0.0f), tonemap), 1.0f));
+    return (uint8_t)((pipeline->lut[(uint32_t)(t * (float)(COLOR_LUT_SIZE - 1) + 0.5f)] + dither) >> 8);
+}
+
+// Row y of linear pixels to dithered 8-bit sRGB. The curve is a constant in each loop, so every one is vectorized
+// up to the table lookup.
+TRAYRACING_KERNEL_INLINE void color_encode_rgb8_kernel(ColorPipeline const *pipeline, Vec3 const *pixels, uint8_t *bytes, uint32_t count, uint32_t y)
+{
+    uint16_t const *const dither = pipeline->dither[y & 3];
+    uint8_t const tonemap = pipeline->tonemap;
+
+    if (sizeof(Vec3) == 3 * sizeof(float)) {
+        float const *const channels = (float const *)pixels;
+        uint32_t const channelCount = 3 * count;
+
+        for (uint32_t i = 0; i < channelCount; i += 12)
+        {
+            uint32_t const n = channelCount - i < 12 ? channelCount - i : 12;
+
+            if (tonemap == TM_ACES) {
+                for (uint32_t j = 0; j < n; ++j)
+                {
+                    bytes[i + j] = colorpipeline_encode(pipeline, channels[i + j], TM_ACES, dither[j]);
+                }
+            } else if (tonemap == TM_REINHARD) {
+                for (uint32_t j = 0; j < n; ++j)
+                {
+                    bytes[i + j] = colorpipeline_encode(pipeline, channels[i + j], TM_REINHARD, dither[j]);
+                }
+            } else {
+                for (uint32_t j = 0; j < n; ++j)
+                {
+                    bytes[i + j] = colorpipeline_encode(pipeline, channels[i + j], TM_CLAMP, dither[j]);
+                }
+            }
+        }
+    } else {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            for (uint32_t c = 0; c < 3; ++c)
+            {
+                bytes[3 * i + c] = colorpipeline_encode(pipeline, pixels[i].v[c], tonemap, dither[3 * (i & 3) + c]);
+            }
+        }
+    }
+}
+
+static void color_encode_rgb8(ColorPipeline const *pipeline, Vec3 const *pixels, uint8_t *bytes, uint32_t count, uint32_t y)
+{
+    color_encode_rgb8_kernel(pipeline, pixels, bytes, count, y);
+}
+
+#ifdef TRAYRACING_DISPATCH
+// The same loops compiled for wider vectors.
+TRAYRACING_TARGET_AVX2 static void denoise_band_avx2(void *context, uint32_t band)
+{
+    denoise_band_kernel(context, band);
+}
+
+TRAYRACING_TARGET_AVX2 static void frame_convert_rgb8_avx2(Vec3 const *pixels, uint8_t *bytes, uint32_t count)
+{
+    frame_convert_rgb8_kernel(pixels, bytes, count);
+}
+
+TRAYRACING_TARGET_AVX2 static void color_encode_rgb8_avx2(ColorPipeline const *pipeline, Vec3 const *pixels, uint8_t *bytes, uint32_t count, uint32_t y)
+{
+    color_encode_rgb8_kernel(pipeline, pixels, bytes, count, y);
+}
+
+TRAYRACING_TARGET_AVX512 static void denoise_band_avx512(void *context, uint32_t band)
+{
+    denoise_band_kernel(context, band);
+}
+
+TRAYRACING_TARGET_AVX512 static void frame_convert_rgb8_avx512(Vec3 const *pixels, uint8_t *bytes, uint32_t count)
+{
+    frame_convert_rgb8_kernel(pixels, bytes, count);
+}
+
+TRAYRACING_TARGET_AVX512 static void color_encode_rgb8_avx512(ColorPipeline const *pipeline, Vec3 const *pixels, uint8_t *bytes, uint32_t count, uint32_t y)
+{
+    color_encode_rgb8_kernel(pipeline, pixels, bytes, count, y);
+}
+#endif
+
+// Indexed by CpuIsa - CI_BASELINE.
+static RenderKernels const renderKernelTable[] = {
+    {spheres_nearest, denoise_band, frame_convert_rgb8, color_encode_rgb8},
+#ifdef TRAYRACING_DISPATCH
+    {spheres_nearest_avx2, denoise_band_avx2, frame_convert_rgb8_avx2, color_encode_rgb8_avx2},
+    {spheres_nearest_avx512, denoise_band_avx512, frame_convert_rgb8_avx512, color_encode_rgb8_avx512},
+#endif
+};
+
+#ifdef TRAYRACING_DISPATCH
+static RenderKernels const *renderKernels = NULL;
+#endif
+
+static RenderKernels const *render_kernels(void)
+{
+#ifdef TRAYRACING_DISPATCH
+    if (threadRendersReference) {
+        return &renderKernelTable[0];
+    }
+
+    RenderKernels const *kernels = __atomic_load_n(&renderKernels, __ATOMIC_ACQUIRE);
+    if (kernels == NULL)
+    {
+        cpuisa_select(CI_AUTO);
+        kernels = __atomic_load_n(&renderKernels, __ATOMIC_ACQUIRE);
+    }
+
+    return kernels;
+#else
+    return &renderKernelTable[0];
+#endif
+}
+
+CpuIsa cpuisa_detect(void)
+{
+#ifdef TRAYRACING_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return CI_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return CI_AVX2;
+    }
+#endif
+
+    return CI_BASELINE;
+}
+
+CpuIsa cpuisa_select(CpuIsa isa)
+{
+    CpuIsa const supported = cpuisa_detect();
+
+    if (isa == CI_AUTO)
+    {
+        char const *const name = getenv("TRAYRACING_ISA");
+
+        isa = supported;
+        if (name != NULL && strcmp(name, "baseline") == 0) {
+            isa = CI_BASELINE;
+        } else if (name != NULL && strcmp(name, "avx2") == 0) {
+            isa = CI_AVX2;
+        } else if (name != NULL && strcmp(name, "avx512") == 0) {
+            isa = CI_AVX512;
+        }
+    }
+
+    // Never run a variant the CPU cannot execute.
+    isa = isa > supported ? supported : isa;
+
+#ifdef TRAYRACING_DISPATCH
+    __atomic_store_n(&renderKernels, &renderKernelTable[isa - CI_BASELINE], __ATOMIC_RELEASE);
+#endif
+
+    return isa;
+}
+
+CpuIsa cpuisa_current(void)
+{
+    return (CpuIsa)(CI_BASELINE + (render_kernels() - renderKernelTable));
+}
+
+// The plain path optimized renders are checked against: serial, one tile after the other, every primary ray tested
+// against every sphere and the baseline kernels whatever the CPU supports. Vector math still follows
+// TRAYRACING_SIMD, golden frames are best taken without it.
+float scene_render_reference(Scene const *const scene, Frame *const frame)
+{
+    threadRendersReference = 1;
+    float const frameTime = scene_render(scene, frame);
+    threadRendersReference = 0;
+
+    return frameTime;
+}
+
+void frame_denoise(Frame *const frame, GBuffer const *const gbuffer, DenoiseBuffer *const scratch)
+{
+    // Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010), guided by the G-buffer of the frame.
+    // The colors are filtered in planar form, converting from and to the interleaved frame only once.
+    for (uint32_t i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i)
+    {
+        scratch->color[0][0][i] = frame->data[i].r;
+        scratch->color[0][1][i] = frame->data[i].g;
+        scratch->color[0][2][i] = frame->data[i].b;
+    }
+
+    uint32_t current = 0;
+
+    for (uint32_t iteration = 0; iteration < DENOISE_ITERATIONS; ++iteration, current ^= 1)
+    {
+        float const colorSigma = DENOISE_SIGMA_COLOR / (float)(1u << iteration);
+
+        DenoisePass const pass = {
+            {scratch->color[current][0], scratch->color[current][1], scratch->color[current][2]},
+            {scratch->color[current ^ 1][0], scratch->color[current ^ 1][1], scratch->color[current ^ 1][2]},
+            gbuffer,
+            (int32_t)(1u << iteration),
+            1.0f / (colorSigma * colorSigma)
+        };
+        threadpool_run((FRAME_HEIGHT + DENOISE_BAND_HEIGHT - 1) / DENOISE_BAND_HEIGHT, render_kernels()->denoiseBand, (void *)&pass);
+    }
+
+    for (uint32_t i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i)
+    {
+        frame->data[i].r = scratch->color[current][0][i];
+        frame->data[i].g = scratch->color[current][1][i];
+        frame->data[i].b = scratch->color[current][2][i];
+    }
+}
+
+// Exposure is given in stops. Without dithering every channel is rounded to the nearest 8-bit level.
+ColorPipeline colorpipeline_create(float exposure, Tonemap tonemap, uint8_t dither)
+{
+    static uint8_t const bayer[4][4] = {
+        { 0,  8,  2, 10},
+        {12,  4, 14,  6},
+        { 3, 11,  1,  9},
+        {15,  7, 13,  5}
+    };
+
+    ColorPipeline pipeline;
+    pipeline.scale = exp2f(exposure);
+    pipeline.tonemap = (uint8_t)tonemap;
+
+    for (uint32_t y = 0; y < 4; ++y)
+    {
+        for (uint32_t i = 0; i < 12; ++i)
+        {
+            pipeline.dither[y][i] = dither ? (uint16_t)(16 * bayer[y][i / 3] + 8) : 128;
+        }
+    }
+
+    for (uint32_t i = 0; i < COLOR_LUT_SIZE; ++i)
+    {
+        float const t = (float)i / (float)(COLOR_LUT_SIZE - 1);
+        float const linear = t * t;
+        float const encoded = linear <= 0.0031308f ? 12.92f * linear : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+        pipeline.lut[i] = (uint16_t)fminf(encoded * 255.0f * 256.0f + 0.5f, 255.0f * 256.0f);
+    }
+
+    return pipeline;
+}
+
+typedef struct ColorPass {
+    ColorPipeline const *pipeline;
+    Frame const *input;
+    Frame *output;
+    uint8_t *bytes;
+} ColorPass;
+
+static void color_band(void *context, uint32_t band)
+{
+    ColorPass const *const pass = (ColorPass const *)context;
+    uint32_t const y0 = band * COLOR_BAND_HEIGHT;
+    uint32_t const y1 = y0 + COLOR_BAND_HEIGHT < FRAME_HEIGHT ? y0 + COLOR_BAND_HEIGHT : FRAME_HEIGHT;
+    uint8_t row[3 * FRAME_WIDTH];
+
+    for (uint32_t y = y0; y < y1; ++y)
+    {
+        Vec3 const *const pixels = &(pass->input->data[y * FRAME_WIDTH]);
+
+        if (pass->bytes != NULL)
+        {
+            render_kernels()->encodeRgb8(pass->pipeline, pixels, &(pass->bytes[3 * y * FRAME_WIDTH]), FRAME_WIDTH, y);
+            continue;
+        }
+
+        // Written back as the exact 8-bit levels, so converting the frame again reproduces them.
+        render_kernels()->encodeRgb8(pass->pipeline, pixels, row, FRAME_WIDTH, y);
+        Vec3 *const output = &(pass->output->data[y * FRAME_WIDTH]);
+        for (uint32_t x = 0; x < FRAME_WIDTH; ++x)
+        {
+            output[x].r = (float)row[3 * x + 0] * (1.0f / 255.0f);
+            output[x].g = (float)row[3 * x + 1] * (1.0f / 255.0f);
+            output[x].b = (float)row[3 * x + 2] * (1.0f / 255.0f);
+        }
+    }
+}
+
+// Applies the pipeline in place, the frame then holds display-ready values for glDrawPixels or frame_save_to_file.
+void frame_tonemap(Frame *const frame, ColorPipeline const *const pipeline)
+{
+    ColorPass const pass = {pipeline, frame, frame, NULL};
+
+    threadpool_run((FRAME_HEIGHT + COLOR_BAND_HEIGHT - 1) / COLOR_BAND_HEIGHT, color_band, (void *)&pass);
+}
+
+// Applies the pipeline while converting, bytes receives 3 * FRAME_WIDTH * FRAME_HEIGHT channels, bottom row first.
+void frame_encode_rgb8(Frame const *const frame, ColorPipeline const *const pipeline, uint8_t *const bytes)
+{
+    ColorPass const pass = {pipeline, frame, NULL, bytes};
+
+    threadpool_run((FRAME_HEIGHT + COLOR_BAND_HEIGHT - 1) / COLOR_BAND_HEIGHT, color_band, (void *)&pass);
+}
+
+float scene_render_gbuffer(Scene const *const scene, Frame *const frame, GBuffer *const gbuffer, uint32_t samplesPerPixel)
+{
+    RenderView view = renderview_from_frame(scene, frame);
+    view.samplesPerPixel = samplesPerPixel;
+    view.gbuffer = gbuffer;
+
+    return scene_render_view(scene, &view);
 }
 
 #endif // TRAYRACING_IMPLEMENTATION
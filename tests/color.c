@@ -0,0 +1,162 @@
+#define TRAYRACING_IMPLEMENTATION
+#include "trayracing/trayracing.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Checks the color pipeline: the sRGB table against the closed-form curve, the reach of the ordered dither, and that
+// frame_tonemap and frame_encode_rgb8 produce the same bytes under every instruction set the CPU supports.
+
+// Values per 8-bit level the undithered curve is probed at.
+#define CURVE_PROBES_PER_LEVEL 64
+// Undithered output rounds to the nearest level, off by at most one step of the 8.8 fixed point table.
+#define LEVEL_MAX_ERROR (0.5 + 1.0 / 256.0)
+// Between the entries the nearest one is taken, which moves the curve by up to a twentieth of a level.
+#define NEAREST_ENTRY_MAX_ERROR 0.05
+
+Frame input;
+Frame tonemapped;
+uint8_t encoded[3 * FRAME_WIDTH * FRAME_HEIGHT];
+uint8_t converted[3 * FRAME_WIDTH * FRAME_HEIGHT];
+uint8_t baseline[3][2][3 * FRAME_WIDTH * FRAME_HEIGHT];
+
+static double srgb_encode(double linear)
+{
+    return linear <= 0.0031308 ? 12.92 * linear : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+}
+
+static int color_expect(char const *name, int condition)
+{
+    printf("color, %s: %s\n", name, condition ? "ok" : "FAILED");
+
+    return !condition;
+}
+
+static uint32_t color_check_curve(void)
+{
+    ColorPipeline const pipeline = colorpipeline_create(0.0f, TM_CLAMP, 0);
+    uint32_t failures = 0;
+
+    // Every table output is the closed-form curve at the entry's sample point, rounded to the nearest level.
+    double tableError = 0.0;
+    for (uint32_t i = 0; i < COLOR_LUT_SIZE; ++i)
+    {
+        double const t = (double)i / (COLOR_LUT_SIZE - 1);
+        uint32_t const level = (uint32_t)(pipeline.lut[i] + pipeline.dither[0][0]) >> 8;
+        tableError = fmax(tableError, fabs((double)level - 255.0 * srgb_encode(t * t)));
+    }
+    printf("color, table: max error %g levels\n", tableError);
+    failures += (uint32_t)color_expect("table outputs", tableError <= LEVEL_MAX_ERROR);
+
+    double curveError = 0.0;
+    for (uint32_t i = 0; i <= 255 * CURVE_PROBES_PER_LEVEL; ++i)
+    {
+        float const v = (float)i / (float)(255 * CURVE_PROBES_PER_LEVEL);
+        uint8_t const level = colorpipeline_encode(&pipeline, v, TM_CLAMP, pipeline.dither[0][0]);
+        curveError = fmax(curveError, fabs((double)level - 255.0 * srgb_encode((double)v)));
+    }
+    printf("color, curve: max error %g levels\n", curveError);
+    failures += (uint32_t)color_expect("undithered curve", curveError <= LEVEL_MAX_ERROR + NEAREST_ENTRY_MAX_ERROR);
+
+    return failures;
+}
+
+static uint32_t color_check_dither(void)
+{
+    ColorPipeline const plain = colorpipeline_create(0.0f, TM_CLAMP, 0);
+    ColorPipeline const dithered = colorpipeline_create(0.0f, TM_CLAMP, 1);
+    int valid = 1;
+
+    for (uint32_t i = 0; i <= 255 * CURVE_PROBES_PER_LEVEL; ++i)
+    {
+        float const v = (float)i / (float)(255 * CURVE_PROBES_PER_LEVEL);
+        int const level = colorpipeline_encode(&plain, v, TM_CLAMP, plain.dither[0][0]);
+
+        for (uint32_t y = 0; y < 4; ++y)
+        {
+            for (uint32_t j = 0; j < 12; ++j)
+            {
+                int const ditheredLevel = colorpipeline_encode(&dithered, v, TM_CLAMP, dithered.dither[y][j]);
+                valid &= abs(ditheredLevel - level) <= 1;
+            }
+        }
+    }
+
+    return (uint32_t)color_expect("dither within one level", valid);
+}
+
+// HDR values up to 4 with a few negatives, so that every tonemap and the clamps are exercised.
+static void color_fill_input(void)
+{
+    srand(11);
+    for (uint32_t i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i)
+    {
+        input.data[i] = LITERAL(Vec3){.r = rand_float(-0.1f, 4.0f), .g = rand_float(0.0f, 1.0f), .b = (float)i / (FRAME_WIDTH * FRAME_HEIGHT)};
+    }
+}
+
+// Encodes the input directly and through frame_tonemap, both have to give the same bytes.
+static uint32_t color_check_paths(char const *isaName, Tonemap tonemap, uint8_t dither)
+{
+    ColorPipeline const pipeline = colorpipeline_create(0.5f, tonemap, dither);
+
+    frame_encode_rgb8(&input, &pipeline, encoded);
+
+    tonemapped = input;
+    frame_tonemap(&tonemapped, &pipeline);
+    for (uint32_t y = 0; y < FRAME_HEIGHT; ++y)
+    {
+        render_kernels()->convertRgb8(&(tonemapped.data[y * FRAME_WIDTH]), &(converted[3 * y * FRAME_WIDTH]), FRAME_WIDTH);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s, tonemap %d, dither %u, tonemap matches encode", isaName, (int)tonemap, dither);
+
+    return (uint32_t)color_expect(name, memcmp(encoded, converted, sizeof(encoded)) == 0);
+}
+
+int main(void)
+{
+    static char const *const isaNames[] = {"auto", "baseline", "avx2", "avx512"};
+    uint32_t failures = 0;
+
+    failures += color_check_curve();
+    failures += color_check_dither();
+
+    color_fill_input();
+
+    for (CpuIsa isa = CI_BASELINE; isa <= CI_AVX512; isa = (CpuIsa)(isa + 1))
+    {
+        cpuisa_select(isa);
+        if (cpuisa_current() != isa) {
+            continue;
+        }
+
+        for (Tonemap tonemap = TM_CLAMP; tonemap <= TM_ACES; tonemap = (Tonemap)(tonemap + 1))
+        {
+            for (uint8_t dither = 0; dither < 2; ++dither)
+            {
+                failures += color_check_paths(isaNames[isa], tonemap, dither);
+
+                // Every instruction set has to give the bytes of the baseline.
+                if (isa == CI_BASELINE)
+                {
+                    memcpy(baseline[tonemap][dither], encoded, sizeof(encoded));
+                }
+                else
+                {
+                    char name[64];
+                    snprintf(name, sizeof(name), "%s, tonemap %d, dither %u, matches baseline", isaNames[isa], (int)tonemap, dither);
+                    failures += (uint32_t)color_expect(name, memcmp(baseline[tonemap][dither], encoded, sizeof(encoded)) == 0);
+                }
+            }
+        }
+    }
+    cpuisa_select(CI_AUTO);
+
+    printf("%u failed\n", failures);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
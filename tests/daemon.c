@@ -0,0 +1,222 @@
+#define TRAYRACING_IMPLEMENTATION
+#include "trayracing/trayracing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Starts the render daemon on a temporary socket in a thread and talks to it as a local client: pipelined requests
+// have to come back exactly like scene_render_view renders them, invalid ones have to be refused without taking the
+// daemon down, and a stop request has to end the daemon while another client still holds its connection open.
+
+#define SCENE_COUNT 2
+#define DAEMON_WORKER_COUNT 2
+// Fails the test rather than hanging it when the daemon does not answer or does not stop.
+#define TIMEOUT_SECONDS 60
+
+typedef struct DaemonThread {
+    char const *socketPath;
+    Scene const *scenes;
+    int result;
+} DaemonThread;
+
+uint8_t resourceMemory[4096];
+uint8_t sceneMemory[SCENE_COUNT][16384];
+
+Vec3 received[3][96 * 64];
+Vec3 expected[96 * 64];
+
+static Scene daemon_scene_create(Arena *const arena, ResourcePool const *resources, uint32_t seed)
+{
+    srand(seed);
+
+    Vec3 eye = {.x = 0.0f, .y = 2.0f, .z = 4.0f};
+    Vec3 up = {.x = 0.0f, .y = 1.0f, .z = 0.0f};
+    Vec3 lookat = {.x = 0.0f, .y = 0.0f, .z = 0.0f};
+    Vec3 ambient = {.x = 0.5f, .y = 0.6f, .z = 0.8f};
+
+    Scene scene = scene_create(arena, resources, camera_create(eye, lookat, up, deg2rad(60.0f)), ambient);
+    scene.seed = seed;
+
+    Vec3 lightDir = {.x = -1.0f, .y = -1.0f, .z = -1.0f};
+    scene_add_light(&scene, light_directional(lightDir, LITERAL(Vec3){.r = 0.8f, .g = 0.8f, .b = 0.8f}));
+
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        Vec3 center = {.x = rand_float(-1.0f, 1.0f), .y = rand_float(-1.0f, 1.0f), .z = rand_float(-1.0f, 1.0f)};
+        MaterialHandle const material = (MaterialHandle)rand_int(0, (int)resources->materialCount - 1);
+        Sphere sphere = {center, rand_float(0.2f, 0.4f), material};
+        scene_add_sphere(&scene, sphere);
+    }
+
+    return scene;
+}
+
+static void *daemon_thread_run(void *arg)
+{
+    DaemonThread *const thread = (DaemonThread *)arg;
+
+    thread->result = renderdaemon_run(thread->socketPath, thread->scenes, SCENE_COUNT, DAEMON_WORKER_COUNT);
+
+    return NULL;
+}
+
+// Waits until the daemon accepts connections.
+static int daemon_wait_ready(char const *socketPath)
+{
+    for (uint32_t attempt = 0; attempt < 500; ++attempt)
+    {
+        int const fd = socket_connect_unix(socketPath);
+        if (fd >= 0)
+        {
+            close(fd);
+            return 0;
+        }
+        usleep(10000);
+    }
+
+    return -1;
+}
+
+static RenderRequest daemon_request_create(uint32_t sceneIndex, Camera camera, uint32_t width, uint32_t height, uint32_t samplesPerPixel)
+{
+    RenderRequest request;
+
+    memset(&request, 0, sizeof(request));
+    request.type = RRT_RENDER;
+    request.sceneIndex = sceneIndex;
+    request.camera = camera;
+    request.width = width;
+    request.height = height;
+    request.samplesPerPixel = samplesPerPixel;
+
+    return request;
+}
+
+// Returns 1 when the pixels differ from the view rendered in this process.
+static int daemon_check(char const *name, Scene const *scenes, RenderRequest const *request, Vec3 const *pixels)
+{
+    RenderView const view = {&(request->camera), expected, request->width, request->height, request->samplesPerPixel, MAX_RAY_DEPTH, 0, NULL};
+    scene_render_view(&scenes[request->sceneIndex], &view);
+
+    size_t const pixelCount = (size_t)request->width * request->height;
+    size_t mismatchCount = 0;
+    for (size_t i = 0; i < pixelCount; ++i)
+    {
+        if (pixels[i].r != expected[i].r || pixels[i].g != expected[i].g || pixels[i].b != expected[i].b) {
+            ++mismatchCount;
+        }
+    }
+
+    printf("daemon, %s: %s\n", name, mismatchCount == 0 ? "identical" : "FAILED");
+    if (mismatchCount != 0) {
+        printf("%zu of %zu pixels differ from scene_render_view\n", mismatchCount, pixelCount);
+    }
+
+    return mismatchCount != 0;
+}
+
+static int daemon_expect(char const *name, int condition)
+{
+    printf("daemon, %s: %s\n", name, condition ? "ok" : "FAILED");
+
+    return !condition;
+}
+
+int main(void)
+{
+    alarm(TIMEOUT_SECONDS);
+
+    Arena resourceArena = arena_create(resourceMemory, sizeof(resourceMemory));
+    ResourcePool resourcePool = resourcepool_create(&resourceArena);
+
+    resourcepool_add_material(&resourcePool, material_emerald());
+    resourcepool_add_material(&resourcePool, material_gold());
+    resourcepool_add_material(&resourcePool, material_glass());
+    resourcepool_add_material(&resourcePool, material_copper());
+
+    Arena sceneArenas[SCENE_COUNT];
+    Scene scenes[SCENE_COUNT];
+    for (uint32_t i = 0; i < SCENE_COUNT; ++i)
+    {
+        sceneArenas[i] = arena_create(sceneMemory[i], sizeof(sceneMemory[i]));
+        scenes[i] = daemon_scene_create(&sceneArenas[i], &resourcePool, i + 1);
+    }
+
+    char socketPath[64];
+    snprintf(socketPath, sizeof(socketPath), "/tmp/trayracing_test_%ld.sock", (long)getpid());
+
+    DaemonThread thread = {socketPath, scenes, -1};
+    pthread_t daemon;
+    if (pthread_create(&daemon, NULL, daemon_thread_run, &thread) != 0 || daemon_wait_ready(socketPath) != 0)
+    {
+        printf("daemon: could not start on '%s'\n", socketPath);
+        return EXIT_FAILURE;
+    }
+
+    uint32_t failures = 0;
+
+    Camera const sideCamera = camera_create(LITERAL(Vec3){.x = 3.0f, .y = 1.0f, .z = 2.0f}, vec3_zero(), vec3_unit_y(), deg2rad(45.0f));
+    RenderRequest const requests[3] = {
+        daemon_request_create(0, scenes[0].camera, 96, 64, 4),
+        daemon_request_create(1, sideCamera, 33, 47, 1),
+        daemon_request_create(0, sideCamera, 64, 64, 2)
+    };
+    Vec3 *const pixels[3] = {received[0], received[1], received[2]};
+
+    // Pipelined on one connection, the responses have to come back in order.
+    if (renderdaemon_request(socketPath, requests, pixels, 3) != 0)
+    {
+        printf("daemon, pipelined: FAILED\n");
+        ++failures;
+    }
+    else
+    {
+        failures += (uint32_t)daemon_check("pipelined 0", scenes, &requests[0], received[0]);
+        failures += (uint32_t)daemon_check("pipelined 1", scenes, &requests[1], received[1]);
+        failures += (uint32_t)daemon_check("pipelined 2", scenes, &requests[2], received[2]);
+    }
+
+    RenderRequest const invalidRequests[4] = {
+        daemon_request_create(SCENE_COUNT, scenes[0].camera, 16, 16, 1),
+        daemon_request_create(0, scenes[0].camera, 0, 16, 1),
+        daemon_request_create(0, scenes[0].camera, MAX_DAEMON_RESOLUTION + 1, 16, 1),
+        daemon_request_create(0, scenes[0].camera, 16, 16, MAX_DAEMON_SAMPLES + 1)
+    };
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "invalid %u refused", i);
+        failures += (uint32_t)daemon_expect(name, renderdaemon_request(socketPath, &invalidRequests[i], pixels, 1) != 0);
+    }
+
+    // A valid request pipelined behind an invalid one is still answered.
+    RenderRequest const mixedRequests[2] = {invalidRequests[0], requests[1]};
+    int const fd = socket_connect_unix(socketPath);
+    RenderResponse response = {RS_OK, 0, 0};
+    int const mixedSent = fd >= 0 && renderrequest_write(fd, &mixedRequests[0]) == 0 && renderrequest_write(fd, &mixedRequests[1]) == 0;
+    int const invalidRead = mixedSent && renderresponse_read(fd, &response) == 0 && response.status == RS_INVALID_REQUEST;
+    int const validRead = invalidRead && renderresponse_read(fd, &response) == 0 && response.status == RS_OK &&
+                          response.width == requests[1].width && response.height == requests[1].height &&
+                          pixels_read(fd, received[1], (size_t)response.width * response.height) == 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    failures += (uint32_t)daemon_expect("invalid then valid", validRead);
+    if (validRead) {
+        failures += (uint32_t)daemon_check("after invalid", scenes, &requests[1], received[1]);
+    }
+
+    // A client idling on an open connection must not keep the daemon from stopping.
+    int const idleClient = socket_connect_unix(socketPath);
+    failures += (uint32_t)daemon_expect("stop", renderdaemon_stop(socketPath) == 0);
+    pthread_join(daemon, NULL);
+    if (idleClient >= 0) {
+        close(idleClient);
+    }
+    failures += (uint32_t)daemon_expect("stopped", thread.result == 0);
+
+    printf("%u failed\n", failures);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
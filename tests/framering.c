@@ -0,0 +1,216 @@
+#define TRAYRACING_IMPLEMENTATION
+#include "trayracing/trayracing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Writes frames into a shared frame ring and reads them from a forked consumer that maps the ring by name: a published
+// frame has to arrive intact and pass framering_check, and must fail it once the writer has come around to its slot
+// again. Rings whose header does not describe the frames of this build have to be refused by framering_open.
+
+#define SLOT_COUNT 2
+// Fails the test rather than hanging it when the consumer never answers.
+#define TIMEOUT_SECONDS 60
+
+uint8_t resourceMemory[4096];
+uint8_t sceneMemory[16384];
+
+Frame expected;
+
+static Scene framering_scene_create(Arena *const arena, ResourcePool const *resources)
+{
+    srand(7);
+
+    Vec3 eye = {.x = 0.0f, .y = 2.0f, .z = 4.0f};
+    Vec3 up = {.x = 0.0f, .y = 1.0f, .z = 0.0f};
+    Vec3 lookat = {.x = 0.0f, .y = 0.0f, .z = 0.0f};
+    Vec3 ambient = {.x = 0.5f, .y = 0.6f, .z = 0.8f};
+
+    Scene scene = scene_create(arena, resources, camera_create(eye, lookat, up, deg2rad(60.0f)), ambient);
+
+    Vec3 lightDir = {.x = -1.0f, .y = -1.0f, .z = -1.0f};
+    scene_add_light(&scene, light_directional(lightDir, LITERAL(Vec3){.r = 0.8f, .g = 0.8f, .b = 0.8f}));
+
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        Vec3 center = {.x = rand_float(-1.0f, 1.0f), .y = rand_float(-1.0f, 1.0f), .z = rand_float(-1.0f, 1.0f)};
+        MaterialHandle const material = (MaterialHandle)rand_int(0, (int)resources->materialCount - 1);
+        Sphere sphere = {center, rand_float(0.2f, 0.4f), material};
+        scene_add_sphere(&scene, sphere);
+    }
+
+    return scene;
+}
+
+static int framering_expect(char const *name, int condition)
+{
+    printf("framering, %s: %s\n", name, condition ? "ok" : "FAILED");
+    fflush(stdout);
+
+    return !condition;
+}
+
+// Runs in the forked consumer, the parent publishes the next frames once it reads a byte from toWriter.
+static int framering_consume(char const *name, int toWriter, int fromWriter)
+{
+    uint32_t failures = 0;
+    FrameRing ring;
+
+    if (framering_open(&ring, name) != 0) {
+        return framering_expect("consumer open", 0);
+    }
+
+    uint64_t sequence = 0;
+    Frame const *const frame = framering_acquire(&ring, &sequence);
+    failures += (uint32_t)framering_expect("acquire published", frame != NULL && sequence == 1);
+    if (frame != NULL)
+    {
+        failures += (uint32_t)framering_expect("pixels intact", memcmp(frame->data, expected.data, sizeof(expected.data)) == 0);
+        failures += (uint32_t)framering_expect("check intact", framering_check(&ring, sequence));
+    }
+
+    // The writer laps the slot of the frame just read.
+    char signal = 0;
+    if (write(toWriter, &signal, 1) != 1 || read(fromWriter, &signal, 1) != 1) {
+        ++failures;
+    }
+    failures += (uint32_t)framering_expect("check lapped", !framering_check(&ring, sequence));
+
+    uint64_t latest = 0;
+    failures += (uint32_t)framering_expect("acquire latest", framering_acquire(&ring, &latest) != NULL && latest == 1 + SLOT_COUNT &&
+                                                             framering_check(&ring, latest));
+
+    framering_close(&ring);
+
+    return failures != 0;
+}
+
+// Every field framering_open checks is broken in turn on the live header of the writer.
+static uint32_t framering_check_layouts(FrameRing const *const ring, char const *name)
+{
+    FrameRingHeader *const header = ring->header;
+    uint32_t *const fields[] = {&header->magic, &header->width, &header->height, &header->format, &header->slotCount, &header->slotSize, &header->slotOffset};
+    char const *const fieldNames[] = {"magic", "width", "height", "format", "slot count", "slot size", "slot offset"};
+    uint32_t failures = 0;
+
+    for (uint32_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i)
+    {
+        uint32_t const value = *fields[i];
+        *fields[i] = value == 1 ? 0x10000u : value + 1;
+
+        char testName[64];
+        FrameRing reader;
+        snprintf(testName, sizeof(testName), "refuses wrong %s", fieldNames[i]);
+        int const opened = framering_open(&reader, name) == 0;
+        if (opened) {
+            framering_close(&reader);
+        }
+        failures += (uint32_t)framering_expect(testName, !opened);
+
+        *fields[i] = value;
+    }
+
+    // An object too small to even hold the header.
+    char tinyName[2 * FRAME_RING_MAX_NAME];
+    snprintf(tinyName, sizeof(tinyName), "%s_tiny", name);
+    int const fd = shm_open(tinyName, O_CREAT | O_RDWR, 0600);
+    if (fd >= 0)
+    {
+        int const resized = ftruncate(fd, 64) == 0;
+        close(fd);
+
+        FrameRing reader;
+        int const opened = framering_open(&reader, tinyName) == 0;
+        if (opened) {
+            framering_close(&reader);
+        }
+        failures += (uint32_t)framering_expect("refuses truncated", resized && !opened);
+        shm_unlink(tinyName);
+    }
+
+    FrameRing reader;
+    failures += (uint32_t)framering_expect("refuses missing", framering_open(&reader, "/trayracing_test_missing") != 0);
+
+    return failures;
+}
+
+int main(void)
+{
+    alarm(TIMEOUT_SECONDS);
+
+    Arena resourceArena = arena_create(resourceMemory, sizeof(resourceMemory));
+    Arena sceneArena = arena_create(sceneMemory, sizeof(sceneMemory));
+    ResourcePool resourcePool = resourcepool_create(&resourceArena);
+
+    resourcepool_add_material(&resourcePool, material_emerald());
+    resourcepool_add_material(&resourcePool, material_gold());
+    resourcepool_add_material(&resourcePool, material_glass());
+    resourcepool_add_material(&resourcePool, material_copper());
+
+    Scene const scene = framering_scene_create(&sceneArena, &resourcePool);
+    scene_render(&scene, &expected);
+
+    char name[FRAME_RING_MAX_NAME];
+    snprintf(name, sizeof(name), "/trayracing_test_%ld", (long)getpid());
+
+    FrameRing ring;
+    if (framering_create(&ring, name, SLOT_COUNT) != 0)
+    {
+        printf("framering: could not create '%s'\n", name);
+        return EXIT_FAILURE;
+    }
+
+    uint32_t failures = 0;
+    uint64_t sequence = 0;
+
+    failures += (uint32_t)framering_expect("empty before publish", framering_acquire(&ring, &sequence) == NULL);
+
+    scene_render(&scene, framering_begin(&ring));
+    failures += (uint32_t)framering_expect("nothing while rendering", framering_acquire(&ring, &sequence) == NULL);
+    framering_publish(&ring);
+
+    failures += framering_check_layouts(&ring, name);
+
+    int toWriter[2];
+    int fromWriter[2];
+    if (pipe(toWriter) != 0 || pipe(fromWriter) != 0)
+    {
+        framering_close(&ring);
+        return EXIT_FAILURE;
+    }
+
+    fflush(NULL);
+    pid_t const consumer = fork();
+    if (consumer == 0) {
+        _exit(framering_consume(name, toWriter[1], fromWriter[0]));
+    }
+
+    char signal = 0;
+    if (consumer > 0 && read(toWriter[0], &signal, 1) == 1)
+    {
+        for (uint32_t i = 0; i < SLOT_COUNT; ++i)
+        {
+            Frame *const slot = framering_begin(&ring);
+            memset(slot, 0, sizeof(*slot));
+            framering_publish(&ring);
+        }
+        if (write(fromWriter[1], &signal, 1) != 1) {
+            ++failures;
+        }
+    }
+
+    int status = 1;
+    if (consumer < 0 || waitpid(consumer, &status, 0) != consumer || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        ++failures;
+    }
+
+    framering_close(&ring);
+
+    FrameRing reader;
+    failures += (uint32_t)framering_expect("name removed on close", framering_open(&reader, name) != 0);
+
+    printf("%u failed\n", failures);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
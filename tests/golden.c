@@ -0,0 +1,629 @@
+#define TRAYRACING_IMPLEMENTATION
+#include "trayracing/trayracing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Renders seeded scenes through scene_render_reference and checks the optimized paths against them, up to rounding
+// where they trace the same rays and within the bounds below where they are lossy. The reference frames and the
+// differences of failing paths are written to the folder given as the first argument. Built with
+// TRAYRACING_SIMD the reference frames of a scalar run are loaded from there instead, and the SSE vector math is
+// checked against them. Built with GOLDEN_FASTMATH and the release flags the same is done for -ffast-math.
+
+// Without -ffast-math every path has to reproduce the reference up to rounding.
+#define PATH_TOLERANCE 1e-4f
+#define PATH_MAX_MISMATCHES 0
+#define PATH_MIN_PSNR 80.0f
+
+// Quantized sphere centers and radii move silhouettes, and the shadows and reflections of them, by a fraction of a
+// pixel.
+#define PACKED_TOLERANCE 0.01f
+#define PACKED_MAX_MISMATCHES (FRAME_WIDTH * FRAME_HEIGHT / 100)
+#define PACKED_MIN_PSNR 45.0f
+
+// Streamed bands are compared as 8-bit PPMs, rounding may flip a byte by one.
+#define STREAM_TOLERANCE (1.5f / 255.0f)
+#define STREAM_MAX_MISMATCHES 0
+#define STREAM_MIN_PSNR 80.0f
+#define STREAM_BAND_HEIGHT 48
+
+// Half of the pixels are interpolated from their neighbours, which blurs edges and thin highlights.
+#define CHECKERBOARD_TOLERANCE 0.05f
+#define CHECKERBOARD_MAX_MISMATCHES (FRAME_WIDTH * FRAME_HEIGHT / 20)
+#define CHECKERBOARD_MIN_PSNR 30.0f
+
+// Half the resolution upscaled bilinearly blurs every edge of the frame.
+#define UPSCALE_TOLERANCE 0.05f
+#define UPSCALE_MAX_MISMATCHES (FRAME_WIDTH * FRAME_HEIGHT / 5)
+#define UPSCALE_MIN_PSNR 25.0f
+
+// The reciprocal square root of the SSE backend moves a few silhouette and caustic pixels further than that.
+#define SIMD_TOLERANCE 0.01f
+#define SIMD_MAX_MISMATCHES (FRAME_WIDTH * FRAME_HEIGHT / 200)
+#define SIMD_MIN_PSNR 45.0f
+
+// Reassociated and contracted arithmetic moves the same kind of pixels as the SSE backend does.
+#define FASTMATH_TOLERANCE 0.01f
+#define FASTMATH_MAX_MISMATCHES (FRAME_WIDTH * FRAME_HEIGHT / 200)
+#define FASTMATH_MIN_PSNR 45.0f
+
+#if defined(TRAYRACING_SIMD)
+#define GOLDEN_LOADS_REFERENCE
+#define GOLDEN_VARIANT "simd"
+#define GOLDEN_VARIANT_TOLERANCE SIMD_TOLERANCE
+#define GOLDEN_VARIANT_MAX_MISMATCHES SIMD_MAX_MISMATCHES
+#define GOLDEN_VARIANT_MIN_PSNR SIMD_MIN_PSNR
+#elif defined(GOLDEN_FASTMATH)
+#define GOLDEN_LOADS_REFERENCE
+#define GOLDEN_VARIANT "fastmath"
+#define GOLDEN_VARIANT_TOLERANCE FASTMATH_TOLERANCE
+#define GOLDEN_VARIANT_MAX_MISMATCHES FASTMATH_MAX_MISMATCHES
+#define GOLDEN_VARIANT_MIN_PSNR FASTMATH_MIN_PSNR
+#endif
+
+// The denoiser is checked on a one-sample frame against a converged one, it has to bring the frame closer to it.
+#define DENOISE_NOISY_SAMPLES 1
+#define DENOISE_CONVERGED_SAMPLES 16
+// Geometry next to misses may pick up at most this much of the sky.
+#define DENOISE_MAX_BLEED 1e-3f
+
+typedef struct GoldenScene {
+    uint32_t seed;
+    uint32_t sphereCount;
+    uint32_t pointLightCount;
+    float spread;
+} GoldenScene;
+
+static GoldenScene const goldenScenes[] = {
+    {1, 20, 0, 1.0f},
+    {2, 20, 16, 1.0f},
+    {3, 150, 16, 4.0f}
+};
+
+uint8_t resourceMemory[4096];
+uint8_t sceneMemory[65536];
+
+Frame reference;
+Frame frame;
+
+#ifndef GOLDEN_LOADS_REFERENCE
+Frame referencePpm;
+Frame batchReference;
+Frame batchFrames[2];
+PackedSphereCluster packedClusters[8];
+Vec3 streamScratch[2 * FRAME_WIDTH * STREAM_BAND_HEIGHT];
+Vec3 scaledScratch[FRAME_WIDTH * FRAME_HEIGHT];
+Frame converged;
+Frame noisy;
+Frame denoised;
+GBuffer gbuffer;
+GBuffer convergedGbuffer;
+DenoiseBuffer denoiseScratch;
+#endif
+
+static Scene golden_scene_create(Arena *const arena, ResourcePool const *resources, GoldenScene const *golden)
+{
+    srand(golden->seed);
+    arena_reset(arena);
+
+    Vec3 eye = {.x = 0.0f, .y = 2.0f, .z = 4.0f};
+    Vec3 up = {.x = 0.0f, .y = 1.0f, .z = 0.0f};
+    Vec3 lookat = {.x = 0.0f, .y = 0.0f, .z = 0.0f};
+    Vec3 ambient = {.x = 0.5f, .y = 0.6f, .z = 0.8f};
+
+    Scene scene = scene_create(arena, resources, camera_create(eye, lookat, up, deg2rad(60.0f)), ambient);
+    scene.seed = golden->seed;
+
+    Vec3 lightDir = {.x = -1.0f, .y = -1.0f, .z = -1.0f};
+    scene_add_light(&scene, light_directional(lightDir, LITERAL(Vec3){.r = 0.8f, .g = 0.8f, .b = 0.8f}));
+
+    for (uint32_t i = 0; i < golden->pointLightCount; ++i)
+    {
+        Vec3 const position = {.x = rand_float(-3.0f, 3.0f), .y = rand_float(0.5f, 2.5f), .z = rand_float(-3.0f, 3.0f)};
+        Vec3 const intensity = {.r = rand_float(0.0f, 0.4f), .g = rand_float(0.0f, 0.4f), .b = rand_float(0.0f, 0.4f)};
+        scene_add_light(&scene, light_point(position, intensity));
+    }
+    scene_build_light_tree(&scene);
+
+    for (uint32_t i = 0; i < golden->sphereCount; ++i)
+    {
+        float const s = golden->spread;
+        Vec3 center = {.x = rand_float(-s, s), .y = rand_float(-1.0f, 1.0f), .z = rand_float(-s, s)};
+        MaterialHandle const material = (MaterialHandle)rand_int(0, (int)resources->materialCount - 1);
+        Sphere sphere = {center, rand_float(0.2f, 0.4f) / sqrtf(s), material};
+        scene_add_sphere(&scene, sphere);
+    }
+
+    Vec3 center = {.x = 0.0f, .y = -102.0f, .z = 0.0f};
+    Sphere sphere = {center, 100.0f, 0};
+    scene_add_sphere(&scene, sphere);
+
+    return scene;
+}
+
+// Returns 1 when the frame fails, after writing its difference to the expected frame.
+static int golden_check(char const *folder, uint32_t sceneIndex, char const *pathName, Frame const *const expected, float tolerance, uint32_t maxMismatches, float minPsnr)
+{
+    FrameComparison const comparison = frame_compare(&frame, expected, tolerance);
+    int const passed = comparison.mismatchCount <= maxMismatches && comparison.psnr >= minPsnr;
+
+    if (comparison.maxError == 0.0f) {
+        printf("scene %u, %s: identical\n", sceneIndex, pathName);
+    } else {
+        printf("scene %u, %s: max error %g, PSNR %.2f dB, %u pixels off by more than %g: %s\n", sceneIndex, pathName,
+               (double)comparison.maxError, (double)comparison.psnr, comparison.mismatchCount, (double)tolerance, passed ? "ok" : "FAILED");
+    }
+    if (passed) {
+        return 0;
+    }
+
+    char diffPath[512];
+    snprintf(diffPath, sizeof(diffPath), "%sscene%u_%s_diff.ppm", folder, sceneIndex, pathName);
+    if (frame_save_diff(&frame, expected, diffPath) == 0) {
+        printf("Difference is saved as '%s'.\n", diffPath);
+    }
+
+    return 1;
+}
+
+#ifndef GOLDEN_LOADS_REFERENCE
+// Writes the frame like scene_render_to_file writes its bands.
+static int golden_save_ppm(Frame const *const source, char const *path)
+{
+    FILE *const file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", FRAME_WIDTH, FRAME_HEIGHT);
+
+    uint8_t row[3 * FRAME_WIDTH];
+    for (uint32_t y = FRAME_HEIGHT; y-- > 0;)
+    {
+        frame_convert_rgb8(&(source->data[y * FRAME_WIDTH]), row, FRAME_WIDTH);
+        fwrite(row, 1, sizeof(row), file);
+    }
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+// Reads a PPM of the frame size back into floats between 0 and 1.
+static int golden_load_ppm(Frame *const target, char const *path)
+{
+    FILE *const file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    int width = 0;
+    int height = 0;
+    int maxValue = 0;
+    uint8_t row[3 * FRAME_WIDTH];
+    int valid = fscanf(file, "P6 %d %d %d", &width, &height, &maxValue) == 3 && fgetc(file) == '\n' &&
+                width == FRAME_WIDTH && height == FRAME_HEIGHT && maxValue == 255;
+
+    for (uint32_t y = FRAME_HEIGHT; valid && y-- > 0;)
+    {
+        valid = fread(row, 1, sizeof(row), file) == sizeof(row);
+        for (uint32_t x = 0; valid && x < FRAME_WIDTH; ++x)
+        {
+            target->data[y * FRAME_WIDTH + x] = LITERAL(Vec3){.r = row[3 * x] / 255.0f, .g = row[3 * x + 1] / 255.0f, .b = row[3 * x + 2] / 255.0f};
+        }
+    }
+
+    fclose(file);
+
+    return valid ? 0 : -1;
+}
+
+static uint32_t golden_check_packed(char const *folder, uint32_t sceneIndex, Scene const *scene)
+{
+    // The same scene with every sphere but the ground, the last one, moved into quantized clusters.
+    PackedSpheres packed = packedspheres_create(packedClusters, sizeof(packedClusters) / sizeof(packedClusters[0]));
+    uint32_t const packedCount = scene->sphereCount - 1;
+    if (packedspheres_add(&packed, scene->spheres, packedCount) != packedCount)
+    {
+        printf("scene %u, packed: spheres do not fit\n", sceneIndex);
+        return 1;
+    }
+
+    Scene packedScene = *scene;
+    packedScene.spheres = &(scene->spheres[packedCount]);
+    packedScene.sphereCount = 1;
+    scene_set_packed_spheres(&packedScene, &packed);
+
+    scene_render(&packedScene, &frame);
+
+    return (uint32_t)golden_check(folder, sceneIndex, "packed", &reference, PACKED_TOLERANCE, PACKED_MAX_MISMATCHES, PACKED_MIN_PSNR);
+}
+
+static uint32_t golden_check_stream(char const *folder, uint32_t sceneIndex, Scene const *scene)
+{
+    char referencePath[512];
+    char streamPath[512];
+    snprintf(referencePath, sizeof(referencePath), "%sscene%u_reference.ppm", folder, sceneIndex);
+    snprintf(streamPath, sizeof(streamPath), "%sscene%u_stream.ppm", folder, sceneIndex);
+
+    RenderSettings const settings = rendersettings_default();
+    if (golden_save_ppm(&reference, referencePath) != 0 || golden_load_ppm(&referencePpm, referencePath) != 0 ||
+        scene_render_to_file(scene, &settings, streamScratch, STREAM_BAND_HEIGHT, streamPath) != 0 ||
+        golden_load_ppm(&frame, streamPath) != 0)
+    {
+        printf("scene %u, stream: could not write or read '%s'\n", sceneIndex, streamPath);
+        return 1;
+    }
+
+    return (uint32_t)golden_check(folder, sceneIndex, "stream", &referencePpm, STREAM_TOLERANCE, STREAM_MAX_MISMATCHES, STREAM_MIN_PSNR);
+}
+
+// The sample cells of every sample count have to tile the pixel with equal areas, which centres the mean offset.
+static uint32_t golden_check_sampling(void)
+{
+    uint32_t failures = 0;
+
+    for (uint32_t samplesPerPixel = 1; samplesPerPixel <= 16; ++samplesPerPixel)
+    {
+        uint32_t const columns = pixel_sample_columns(samplesPerPixel);
+        Vec2 lower[16], upper[16];
+        Vec2 meanOffset = vec2_zero();
+        int valid = 1;
+
+        for (uint32_t sample = 0; sample < samplesPerPixel; ++sample)
+        {
+            pixel_sample_cell(sample, samplesPerPixel, columns, &lower[sample], &upper[sample]);
+
+            float const area = (upper[sample].x - lower[sample].x) * (upper[sample].y - lower[sample].y);
+            valid &= lower[sample].x >= 0.0f && lower[sample].y >= 0.0f && upper[sample].x <= 1.0f && upper[sample].y <= 1.0f;
+            valid &= fabsf(area * (float)samplesPerPixel - 1.0f) < 1e-5f;
+            meanOffset = vec2_add(meanOffset, vec2_scale(0.5f / (float)samplesPerPixel, vec2_add(lower[sample], upper[sample])));
+
+            for (uint32_t other = 0; other < sample; ++other)
+            {
+                valid &= lower[sample].x >= upper[other].x || upper[sample].x <= lower[other].x ||
+                         lower[sample].y >= upper[other].y || upper[sample].y <= lower[other].y;
+            }
+        }
+        valid &= fabsf(meanOffset.x - 0.5f) < 1e-5f && fabsf(meanOffset.y - 0.5f) < 1e-5f;
+
+        if (!valid)
+        {
+            printf("sampling, %u spp: mean offset (%g, %g): FAILED\n", samplesPerPixel, (double)meanOffset.x, (double)meanOffset.y);
+            ++failures;
+        }
+    }
+    printf("sampling: %s\n", failures == 0 ? "ok" : "FAILED");
+
+    return failures;
+}
+
+// Feeds the controller the frame time that the given cost per sample gives for its current settings.
+static void golden_budget_step(BudgetController *const controller, float costPerSample)
+{
+    RenderSettings const *const settings = &(controller->settings);
+
+    budgetcontroller_update(controller, costPerSample * (float)settings->width * (float)settings->height * (float)settings->samplesPerPixel);
+}
+
+static int golden_budget_expect(char const *stage, BudgetController const *const controller, int condition)
+{
+    RenderSettings const *const settings = &(controller->settings);
+
+    if (!condition) {
+        printf("budget, %s: %ux%u, %u spp, depth %u: FAILED\n", stage, settings->width, settings->height,
+               settings->samplesPerPixel, (uint32_t)settings->maxDepth);
+    }
+
+    return !condition;
+}
+
+// Drives the controller with synthetic costs, given as the share of the full frame at one sample per pixel that the
+// budget affords: samples per pixel have to go first, then resolution down to MIN_RENDER_SCALE, then ray depth, and
+// all of them have to come back once frames get cheap again.
+static uint32_t golden_check_budget(void)
+{
+    float const targetFrameTime = 1.0f / 60.0f;
+    float const fullFrame = (float)FRAME_WIDTH * FRAME_HEIGHT;
+    uint32_t const minWidth = (uint32_t)(MIN_RENDER_SCALE * FRAME_WIDTH + 0.5f);
+    uint32_t failures = 0;
+
+    BudgetController controller = budgetcontroller_create(targetFrameTime);
+    RenderSettings const *const settings = &(controller.settings);
+
+    budgetcontroller_update(&controller, 0.0f);
+    failures += (uint32_t)golden_budget_expect("unmeasured frame", &controller, settings->samplesPerPixel == SAMPLES_PER_PIXEL &&
+        settings->width == FRAME_WIDTH && settings->maxDepth == MAX_RAY_DEPTH);
+
+    golden_budget_step(&controller, 0.9f * targetFrameTime / (2.5f * fullFrame));
+    failures += (uint32_t)golden_budget_expect("samples first", &controller, settings->samplesPerPixel == 2 &&
+        settings->width == FRAME_WIDTH && settings->height == FRAME_HEIGHT && settings->maxDepth == MAX_RAY_DEPTH);
+
+    for (uint32_t i = 0; i < 20; ++i)
+    {
+        golden_budget_step(&controller, 0.9f * targetFrameTime / (0.5f * fullFrame));
+    }
+    failures += (uint32_t)golden_budget_expect("then resolution", &controller, settings->samplesPerPixel == 1 &&
+        settings->width < FRAME_WIDTH && settings->width > minWidth && settings->maxDepth == MAX_RAY_DEPTH);
+
+    for (uint32_t i = 0; i < 20; ++i)
+    {
+        golden_budget_step(&controller, 0.9f * targetFrameTime / (0.01f * fullFrame));
+    }
+    failures += (uint32_t)golden_budget_expect("then depth", &controller, settings->samplesPerPixel == 1 &&
+        settings->width == minWidth && settings->maxDepth == 1);
+
+    for (uint32_t i = 0; i < 60; ++i)
+    {
+        golden_budget_step(&controller, 0.9f * targetFrameTime / (100.0f * fullFrame));
+    }
+    failures += (uint32_t)golden_budget_expect("recovery", &controller, settings->samplesPerPixel == SAMPLES_PER_PIXEL &&
+        settings->width == FRAME_WIDTH && settings->height == FRAME_HEIGHT && settings->maxDepth == MAX_RAY_DEPTH);
+
+    printf("budget: %s\n", failures == 0 ? "ok" : "FAILED");
+
+    return failures;
+}
+
+static uint32_t golden_check_scaled(char const *folder, uint32_t sceneIndex, Scene const *scene)
+{
+    uint32_t failures = 0;
+
+    RenderSettings settings = rendersettings_default();
+    scene_render_scaled(scene, &settings, scaledScratch, &frame);
+    failures += (uint32_t)golden_check(folder, sceneIndex, "scaled", &reference, PATH_TOLERANCE, PATH_MAX_MISMATCHES, PATH_MIN_PSNR);
+
+    settings.width = FRAME_WIDTH / 2;
+    settings.height = FRAME_HEIGHT / 2;
+    scene_render_scaled(scene, &settings, scaledScratch, &frame);
+    failures += (uint32_t)golden_check(folder, sceneIndex, "upscaled", &reference, UPSCALE_TOLERANCE, UPSCALE_MAX_MISMATCHES, UPSCALE_MIN_PSNR);
+
+    return failures;
+}
+
+// Tiles of both views are interleaved on the pool, each view has to come out like it does on its own.
+static uint32_t golden_check_batch(char const *folder, uint32_t sceneIndex, Scene const *scene)
+{
+    Vec3 const sideEye = {.x = 3.5f, .y = 1.5f, .z = 2.0f};
+    Camera const cameras[2] = {scene->camera, camera_create(sideEye, vec3_zero(), vec3_unit_y(), deg2rad(45.0f))};
+    uint32_t failures = 0;
+
+    scene_render_batch(scene, cameras, batchFrames, 2);
+
+    Scene sideScene = *scene;
+    sideScene.camera = cameras[1];
+    scene_render_reference(&sideScene, &batchReference);
+
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        char pathName[32];
+
+        RenderView view = renderview_from_frame(scene, &frame);
+        view.camera = &(cameras[i]);
+        scene_render_view(scene, &view);
+        snprintf(pathName, sizeof(pathName), "batch%u_single", i);
+        failures += (uint32_t)golden_check(folder, sceneIndex, pathName, &(batchFrames[i]), 0.0f, 0, PATH_MIN_PSNR);
+
+        frame = batchFrames[i];
+        snprintf(pathName, sizeof(pathName), "batch%u", i);
+        failures += (uint32_t)golden_check(folder, sceneIndex, pathName, i == 0 ? &reference : &batchReference, PATH_TOLERANCE, PATH_MAX_MISMATCHES, PATH_MIN_PSNR);
+    }
+
+    return failures;
+}
+
+// Like frame_denoise, with every band of every iteration run in order on this thread.
+static void golden_denoise_sequential(Frame *const target, GBuffer const *const guides, DenoiseBuffer *const scratch)
+{
+    for (uint32_t i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i)
+    {
+        scratch->color[0][0][i] = target->data[i].r;
+        scratch->color[0][1][i] = target->data[i].g;
+        scratch->color[0][2][i] = target->data[i].b;
+    }
+
+    uint32_t current = 0;
+
+    for (uint32_t iteration = 0; iteration < DENOISE_ITERATIONS; ++iteration, current ^= 1)
+    {
+        float const colorSigma = DENOISE_SIGMA_COLOR / (float)(1u << iteration);
+
+        DenoisePass const pass = {
+            {scratch->color[current][0], scratch->color[current][1], scratch->color[current][2]},
+            {scratch->color[current ^ 1][0], scratch->color[current ^ 1][1], scratch->color[current ^ 1][2]},
+            guides,
+            (int32_t)(1u << iteration),
+            1.0f / (colorSigma * colorSigma)
+        };
+        for (uint32_t band = 0; band < (FRAME_HEIGHT + DENOISE_BAND_HEIGHT - 1) / DENOISE_BAND_HEIGHT; ++band)
+        {
+            render_kernels()->denoiseBand((void *)&pass, band);
+        }
+    }
+
+    for (uint32_t i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i)
+    {
+        target->data[i].r = scratch->color[current][0][i];
+        target->data[i].g = scratch->color[current][1][i];
+        target->data[i].b = scratch->color[current][2][i];
+    }
+}
+
+// Misses are painted white and geometry black, after denoising neither may have leaked into the other.
+static uint32_t golden_check_denoise_misses(uint32_t sceneIndex)
+{
+    uint32_t missCount = 0;
+    for (uint32_t i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i)
+    {
+        int const miss = gbuffer.depth[i] == 0.0f;
+        frame.data[i] = miss ? vec3_one() : vec3_zero();
+        missCount += (uint32_t)miss;
+    }
+
+    frame_denoise(&frame, &gbuffer, &denoiseScratch);
+
+    float bleed = 0.0f;
+    for (uint32_t i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i)
+    {
+        float const expected = gbuffer.depth[i] == 0.0f ? 1.0f : 0.0f;
+        bleed = fmaxf(bleed, fabsf(frame.data[i].r - expected));
+        bleed = fmaxf(bleed, fabsf(frame.data[i].g - expected));
+        bleed = fmaxf(bleed, fabsf(frame.data[i].b - expected));
+    }
+
+    int const passed = missCount != 0 && bleed <= DENOISE_MAX_BLEED;
+    printf("scene %u, denoise misses: %u missed pixels, max bleed %g: %s\n", sceneIndex, missCount, (double)bleed, passed ? "ok" : "FAILED");
+
+    return (uint32_t)!passed;
+}
+
+static uint32_t golden_check_denoise(char const *folder, uint32_t sceneIndex, Scene const *scene)
+{
+    static char const *const isaNames[] = {"auto", "baseline", "avx2", "avx512"};
+    uint32_t failures = 0;
+
+    scene_render_gbuffer(scene, &converged, &convergedGbuffer, DENOISE_CONVERGED_SAMPLES);
+    scene_render_gbuffer(scene, &noisy, &gbuffer, DENOISE_NOISY_SAMPLES);
+
+    // Every instruction set and the bands run one after the other have to give the same bits.
+    for (CpuIsa isa = CI_BASELINE; isa <= CI_AVX512; isa = (CpuIsa)(isa + 1))
+    {
+        cpuisa_select(isa);
+        if (cpuisa_current() != isa) {
+            continue;
+        }
+
+        char pathName[32];
+        frame = noisy;
+        frame_denoise(&frame, &gbuffer, &denoiseScratch);
+        if (isa == CI_BASELINE)
+        {
+            denoised = frame;
+        }
+        else
+        {
+            snprintf(pathName, sizeof(pathName), "denoise_%s", isaNames[isa]);
+            failures += (uint32_t)golden_check(folder, sceneIndex, pathName, &denoised, 0.0f, 0, PATH_MIN_PSNR);
+        }
+
+        frame = noisy;
+        golden_denoise_sequential(&frame, &gbuffer, &denoiseScratch);
+        snprintf(pathName, sizeof(pathName), "denoise_%s_sequential", isaNames[isa]);
+        failures += (uint32_t)golden_check(folder, sceneIndex, pathName, &denoised, 0.0f, 0, PATH_MIN_PSNR);
+    }
+    cpuisa_select(CI_AUTO);
+
+    FrameComparison const before = frame_compare(&noisy, &converged, 0.0f);
+    FrameComparison const after = frame_compare(&denoised, &converged, 0.0f);
+    int const improved = after.psnr > before.psnr;
+    printf("scene %u, denoise: PSNR %.2f dB at %u spp, %.2f dB denoised: %s\n", sceneIndex, (double)before.psnr, DENOISE_NOISY_SAMPLES,
+           (double)after.psnr, improved ? "ok" : "FAILED");
+    failures += (uint32_t)!improved;
+
+    failures += golden_check_denoise_misses(sceneIndex);
+
+    return failures;
+}
+
+static uint32_t golden_check_paths(char const *folder, uint32_t sceneIndex, Scene const *scene)
+{
+    static char const *const isaNames[] = {"auto", "baseline", "avx2", "avx512"};
+    uint32_t failures = 0;
+
+    for (CpuIsa isa = CI_BASELINE; isa <= CI_AVX512; isa = (CpuIsa)(isa + 1))
+    {
+        cpuisa_select(isa);
+        if (cpuisa_current() == isa)
+        {
+            scene_render(scene, &frame);
+            failures += (uint32_t)golden_check(folder, sceneIndex, isaNames[isa], &reference, PATH_TOLERANCE, PATH_MAX_MISMATCHES, PATH_MIN_PSNR);
+        }
+    }
+    cpuisa_select(CI_AUTO);
+
+    RenderJob job;
+    scene_render_async(&job, scene, &frame, NULL, NULL);
+    renderjob_wait(&job);
+    failures += (uint32_t)golden_check(folder, sceneIndex, "threaded", &reference, PATH_TOLERANCE, PATH_MAX_MISMATCHES, PATH_MIN_PSNR);
+
+    SharedFrame shared = frame_create_shared();
+    if (shared.frame == NULL)
+    {
+        printf("scene %u, multiprocess: no shared frame\n", sceneIndex);
+        return failures + 1;
+    }
+    scene_render_multiprocess(scene, &shared, 4);
+    frame = *shared.frame;
+    frame_destroy_shared(&shared);
+    failures += (uint32_t)golden_check(folder, sceneIndex, "multiprocess", &reference, PATH_TOLERANCE, PATH_MAX_MISMATCHES, PATH_MIN_PSNR);
+
+    failures += golden_check_batch(folder, sceneIndex, scene);
+    failures += golden_check_scaled(folder, sceneIndex, scene);
+
+    // Both checkerboard halves of a still camera, each reconstructed from the other one.
+    memset(&frame, 0, sizeof(frame));
+    scene_render_checkerboard(scene, &frame, 0);
+    scene_render_checkerboard(scene, &frame, 1);
+    failures += (uint32_t)golden_check(folder, sceneIndex, "checkerboard", &reference, CHECKERBOARD_TOLERANCE, CHECKERBOARD_MAX_MISMATCHES, CHECKERBOARD_MIN_PSNR);
+
+    failures += golden_check_packed(folder, sceneIndex, scene);
+    failures += golden_check_stream(folder, sceneIndex, scene);
+    failures += golden_check_denoise(folder, sceneIndex, scene);
+
+    return failures;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    char const *const folder = argc > 1 ? argv[1] : "./";
+
+    Arena resourceArena = arena_create(resourceMemory, sizeof(resourceMemory));
+    Arena sceneArena = arena_create(sceneMemory, sizeof(sceneMemory));
+    ResourcePool resourcePool = resourcepool_create(&resourceArena);
+
+    resourcepool_add_material(&resourcePool, material_emerald());
+    resourcepool_add_material(&resourcePool, material_gold());
+    resourcepool_add_material(&resourcePool, material_glass());
+    resourcepool_add_material(&resourcePool, material_silver());
+    resourcepool_add_material(&resourcePool, material_diamond());
+    resourcepool_add_material(&resourcePool, material_copper());
+
+    uint32_t failures = 0;
+
+#ifndef GOLDEN_LOADS_REFERENCE
+    failures += golden_check_sampling();
+    failures += golden_check_budget();
+#endif
+
+    for (uint32_t i = 0; i < sizeof(goldenScenes) / sizeof(goldenScenes[0]); ++i)
+    {
+        Scene const scene = golden_scene_create(&sceneArena, &resourcePool, &goldenScenes[i]);
+
+        char referencePath[512];
+        snprintf(referencePath, sizeof(referencePath), "%sscene%u_reference.pfm", folder, i);
+
+#ifdef GOLDEN_LOADS_REFERENCE
+        if (frame_load_pfm(&reference, referencePath) != 0)
+        {
+            printf("scene %u: no reference frame at '%s', run the scalar test first\n", i, referencePath);
+            ++failures;
+            continue;
+        }
+
+        scene_render(&scene, &frame);
+        failures += (uint32_t)golden_check(folder, i, GOLDEN_VARIANT, &reference, GOLDEN_VARIANT_TOLERANCE, GOLDEN_VARIANT_MAX_MISMATCHES, GOLDEN_VARIANT_MIN_PSNR);
+#else
+        scene_render_reference(&scene, &reference);
+        if (frame_save_pfm(&reference, referencePath) != 0)
+        {
+            printf("scene %u: could not write '%s'\n", i, referencePath);
+            ++failures;
+        }
+
+        failures += golden_check_paths(folder, i, &scene);
+#endif
+    }
+
+    printf("%u failed\n", failures);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,169 @@
+#define TRAYRACING_IMPLEMENTATION
+#include "trayracing/trayracing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Draws text with text_render and through a TextOverlay into frames fenced by guard pixels, at positions inside,
+// across and entirely outside the edges of the frame: both have to write the same pixels and nothing past the frame.
+// A TextOverlay set again with the same arguments has to keep its mask, and rebuild it once the text, position or size
+// changes.
+
+#define GUARD_PIXELS 4096
+#define GUARD_BYTE 0x5a
+
+typedef struct GuardedFrame {
+    Vec3 before[GUARD_PIXELS];
+    Frame frame;
+    Vec3 after[GUARD_PIXELS];
+} GuardedFrame;
+
+typedef struct OverlayCase {
+    char const *text;
+    Vec2 position;
+    uint8_t size;
+} OverlayCase;
+
+static OverlayCase const overlayCases[] = {
+    {"FRAME 16.7 MS", {.x = 20.0f, .y = 570.0f}, 8},
+    {"LEFT-BOTTOM", {.x = -30.0f, .y = -5.0f}, 20},
+    {"TOP RIGHT 0123456789", {.x = 560.0f, .y = 590.0f}, 16},
+    {"RIGHT EDGE/WRAP", {.x = FRAME_WIDTH - 7.0f, .y = 300.0f}, 12},
+    {"TOP EDGE", {.x = 100.0f, .y = FRAME_HEIGHT - 10.0f}, 60},
+    {"NEGATIVE", {.x = -1000.0f, .y = -1000.0f}, 30},
+    {"PAST THE END", {.x = 2.0f * FRAME_WIDTH, .y = 2.0f * FRAME_HEIGHT}, 30},
+    {"HALF.PIXEL", {.x = 10.5f, .y = 20.49f}, 9}
+};
+
+GuardedFrame expected;
+GuardedFrame actual;
+TextOverlay overlay;
+
+static Vec3 const textColor = {.r = 1.0f, .g = 0.5f, .b = 0.25f};
+
+static void overlay_clear(GuardedFrame *const guarded)
+{
+    memset(guarded->before, GUARD_BYTE, sizeof(guarded->before));
+    memset(guarded->after, GUARD_BYTE, sizeof(guarded->after));
+
+    for (uint32_t i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i)
+    {
+        guarded->frame.data[i] = LITERAL(Vec3){.r = (float)(i % FRAME_WIDTH) / FRAME_WIDTH, .g = (float)(i / FRAME_WIDTH) / FRAME_HEIGHT, .b = 0.0f};
+    }
+}
+
+static int overlay_guards_intact(GuardedFrame const *const guarded)
+{
+    uint8_t const *const before = (uint8_t const *)guarded->before;
+    uint8_t const *const after = (uint8_t const *)guarded->after;
+
+    for (size_t i = 0; i < sizeof(guarded->before); ++i)
+    {
+        if (before[i] != GUARD_BYTE || after[i] != GUARD_BYTE) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int overlay_expect(char const *name, int condition)
+{
+    printf("overlay, %s: %s\n", name, condition ? "ok" : "FAILED");
+
+    return !condition;
+}
+
+// Renders the overlay as it is set now next to text_render of the given arguments.
+static int overlay_matches(OverlayCase const *const c)
+{
+    overlay_clear(&expected);
+    overlay_clear(&actual);
+
+    text_render(&expected.frame, c->text, c->position, c->size, textColor);
+    textoverlay_render(&actual.frame, &overlay, textColor);
+
+    return memcmp(&expected.frame, &actual.frame, sizeof(Frame)) == 0;
+}
+
+static uint32_t overlay_check_cases(void)
+{
+    uint32_t failures = 0;
+
+    for (uint32_t i = 0; i < sizeof(overlayCases) / sizeof(overlayCases[0]); ++i)
+    {
+        OverlayCase const *const c = &overlayCases[i];
+        char name[96];
+
+        textoverlay_set(&overlay, c->text, c->position, c->size);
+        int const matches = overlay_matches(c);
+
+        snprintf(name, sizeof(name), "'%s' at (%g, %g), matches text_render", c->text, (double)c->position.x, (double)c->position.y);
+        failures += (uint32_t)overlay_expect(name, matches);
+        snprintf(name, sizeof(name), "'%s' at (%g, %g), guards intact", c->text, (double)c->position.x, (double)c->position.y);
+        failures += (uint32_t)overlay_expect(name, overlay_guards_intact(&expected) && overlay_guards_intact(&actual));
+    }
+
+    return failures;
+}
+
+static uint32_t overlay_check_cache(void)
+{
+    OverlayCase c = {"CACHED 1.0", {.x = 40.0f, .y = 40.0f}, 10};
+    uint32_t failures = 0;
+
+    // The same arguments again must not rebuild the mask, an emptied mask stays empty.
+    textoverlay_set(&overlay, c.text, c.position, c.size);
+    memset(overlay.mask, 0, sizeof(overlay.mask));
+    textoverlay_set(&overlay, c.text, c.position, c.size);
+    overlay_clear(&expected);
+    overlay_clear(&actual);
+    textoverlay_render(&actual.frame, &overlay, textColor);
+    failures += (uint32_t)overlay_expect("unchanged set keeps the mask", memcmp(&expected.frame, &actual.frame, sizeof(Frame)) == 0);
+
+    c.text = "CACHED 2.0";
+    textoverlay_set(&overlay, c.text, c.position, c.size);
+    failures += (uint32_t)overlay_expect("new text rebuilds", overlay_matches(&c));
+
+    memset(overlay.mask, 0, sizeof(overlay.mask));
+    c.position.x += 1.0f;
+    textoverlay_set(&overlay, c.text, c.position, c.size);
+    failures += (uint32_t)overlay_expect("new x rebuilds", overlay_matches(&c));
+
+    memset(overlay.mask, 0, sizeof(overlay.mask));
+    c.position.y -= 1.0f;
+    textoverlay_set(&overlay, c.text, c.position, c.size);
+    failures += (uint32_t)overlay_expect("new y rebuilds", overlay_matches(&c));
+
+    memset(overlay.mask, 0, sizeof(overlay.mask));
+    c.size = 11;
+    textoverlay_set(&overlay, c.text, c.position, c.size);
+    failures += (uint32_t)overlay_expect("new size rebuilds", overlay_matches(&c));
+
+    // Only a prefix of text this long is kept, setting it twice still has to hit the cache.
+    char longText[2 * OVERLAY_MAX_TEXT_LENGTH];
+    memset(longText, 'W', sizeof(longText) - 1);
+    longText[sizeof(longText) - 1] = '\0';
+    textoverlay_set(&overlay, longText, c.position, c.size);
+    memset(overlay.mask, 0, sizeof(overlay.mask));
+    textoverlay_set(&overlay, longText, c.position, c.size);
+    overlay_clear(&expected);
+    overlay_clear(&actual);
+    textoverlay_render(&actual.frame, &overlay, textColor);
+    failures += (uint32_t)overlay_expect("truncated text keeps the mask", memcmp(&expected.frame, &actual.frame, sizeof(Frame)) == 0);
+
+    return failures;
+}
+
+int main(void)
+{
+    uint32_t failures = 0;
+
+    failures += overlay_check_cases();
+    failures += overlay_check_cache();
+
+    printf("%u failed\n", failures);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
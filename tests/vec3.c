@@ -0,0 +1,187 @@
+#include "trayracing/trayracing.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Checks the SSE vec3 functions of TRAYRACING_SIMD against the scalar backend on seeded random vectors. Only built
+// with TRAYRACING_SIMD, the scalar results come from vec3_scalar.c.
+
+#ifndef TRAYRACING_SIMD
+#error "vec3.c checks the TRAYRACING_SIMD backend"
+#endif
+
+#define VECTOR_COUNT 100000
+
+// Exact operations may only differ by the order of their additions.
+#define EXACT_TOLERANCE 1e-6f
+// One Newton-Raphson step on top of the 12-bit reciprocal square root estimate.
+#define NORM_TOLERANCE 4e-6f
+// Sum of three refracted directions with a reciprocal each.
+#define REFRACT_TOLERANCE 2e-5f
+
+float scalar_vec3_dot(float const a[3], float const b[3]);
+float scalar_vec3_length(float const a[3]);
+void scalar_vec3_norm(float const a[3], float out[3]);
+void scalar_vec3_cross(float const a[3], float const b[3], float out[3]);
+void scalar_vec3_reflect(float const n[3], float const v[3], float out[3]);
+void scalar_vec3_refract(float const n[3], float const i[3], float const refrIdx[3], float out[3]);
+void scalar_vec3_lerp(float const a[3], float const b[3], float t, float out[3]);
+
+static uint32_t checkCount = 0;
+static uint32_t failureCount = 0;
+
+static float random_float(float lowerBound, float upperBound)
+{
+    return (upperBound - lowerBound) * ((float)rand() / (float)RAND_MAX) + lowerBound;
+}
+
+static Vec3 random_vec3(float lowerBound, float upperBound)
+{
+    Vec3 const v = {.x = random_float(lowerBound, upperBound), .y = random_float(lowerBound, upperBound), .z = random_float(lowerBound, upperBound)};
+
+    return v;
+}
+
+static Vec3 random_direction(void)
+{
+    for (;;)
+    {
+        Vec3 const v = random_vec3(-1.0f, 1.0f);
+        float const length = sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
+        if (length > 0.1f)
+        {
+            Vec3 const direction = {.x = v.x / length, .y = v.y / length, .z = v.z / length};
+            return direction;
+        }
+    }
+}
+
+static float magnitude(float const a[3])
+{
+    return sqrtf(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+}
+
+// Compares against the scalar result, with the tolerance relative to scale.
+static void check(char const *name, Vec3 simd, float const scalar[3], float tolerance, float scale)
+{
+    float error = 0.0f;
+    for (uint8_t c = 0; c < 3; ++c)
+    {
+        error = fmaxf(error, fabsf(simd.v[c] - scalar[c]));
+    }
+
+    ++checkCount;
+    if (!(error <= tolerance * fmaxf(scale, 1.0f)))
+    {
+        if (failureCount < 10) {
+            printf("%s: (%g, %g, %g), scalar (%g, %g, %g)\n", name, (double)simd.x, (double)simd.y, (double)simd.z,
+                   (double)scalar[0], (double)scalar[1], (double)scalar[2]);
+        }
+        ++failureCount;
+    }
+}
+
+static void check_float(char const *name, float simd, float scalar, float tolerance, float scale)
+{
+    Vec3 const result = {.x = simd, .y = simd, .z = simd};
+    float const expected[3] = {scalar, scalar, scalar};
+
+    check(name, result, expected, tolerance, scale);
+}
+
+static void check_refract(Vec3 n, Vec3 i, Vec3 refrIdx)
+{
+    float const nArray[3] = {n.x, n.y, n.z};
+    float const iArray[3] = {i.x, i.y, i.z};
+    float const refrIdxArray[3] = {refrIdx.x, refrIdx.y, refrIdx.z};
+    float expected[3];
+
+    scalar_vec3_refract(nArray, iArray, refrIdxArray, expected);
+    check("vec3_refract", vec3_refract(n, i, refrIdx), expected, REFRACT_TOLERANCE, 1.0f);
+}
+
+// Total internal reflection has to give the reflected direction on both backends.
+static void check_total_internal_reflection(void)
+{
+    Vec3 const n = {.x = 0.0f, .y = 1.0f, .z = 0.0f};
+    Vec3 const glass = {.x = 1.5f, .y = 1.5f, .z = 1.5f};
+    Vec3 const dispersive = {.x = 1.2f, .y = 1.5f, .z = 1.8f};
+
+    for (uint32_t k = 0; k < 64; ++k)
+    {
+        // Leaving the medium 60 to 88 degrees from the normal, past the critical angle of 41.8 degrees at 1.5.
+        float const angle = (60.0f + 28.0f * (float)k / 64.0f) * 3.14159265f / 180.0f;
+        Vec3 const i = {.x = sinf(angle), .y = cosf(angle), .z = 0.0f};
+        float const nArray[3] = {n.x, n.y, n.z};
+        float const iArray[3] = {i.x, i.y, i.z};
+        float reflected[3];
+
+        scalar_vec3_reflect(nArray, iArray, reflected);
+        check("vec3_refract (total internal reflection)", vec3_refract(n, i, glass), reflected, EXACT_TOLERANCE, 1.0f);
+        check_refract(n, i, glass);
+        check_refract(n, i, dispersive);
+    }
+}
+
+int main(void)
+{
+    srand(1);
+
+    for (uint32_t k = 0; k < VECTOR_COUNT; ++k)
+    {
+        Vec3 const a = random_vec3(-10.0f, 10.0f);
+        Vec3 const b = random_vec3(-10.0f, 10.0f);
+        float const aArray[3] = {a.x, a.y, a.z};
+        float const bArray[3] = {b.x, b.y, b.z};
+        float const scale = magnitude(aArray) * magnitude(bArray);
+        float expected[3];
+
+        check_float("vec3_dot", vec3_dot(a, b), scalar_vec3_dot(aArray, bArray), EXACT_TOLERANCE, scale);
+        check_float("vec3_length", vec3_length(a), scalar_vec3_length(aArray), EXACT_TOLERANCE, magnitude(aArray));
+
+        scalar_vec3_norm(aArray, expected);
+        check("vec3_norm", vec3_norm(a), expected, NORM_TOLERANCE, 1.0f);
+
+        scalar_vec3_cross(aArray, bArray, expected);
+        check("vec3_cross", vec3_cross(a, b), expected, EXACT_TOLERANCE, scale);
+
+        // Both backends compute a + t (b - a), the results have to be identical.
+        float const t = random_float(-0.5f, 1.5f);
+        scalar_vec3_lerp(aArray, bArray, t, expected);
+        check("vec3_lerp", vec3_lerp(a, b, t), expected, 0.0f, 0.0f);
+
+        Vec3 const n = random_direction();
+        float const nArray[3] = {n.x, n.y, n.z};
+        scalar_vec3_reflect(nArray, bArray, expected);
+        check("vec3_reflect", vec3_reflect(n, b), expected, EXACT_TOLERANCE, magnitude(bArray));
+
+        // Away from the critical angle, where rounding alone could decide between refraction and reflection.
+        Vec3 const i = random_direction();
+        Vec3 const refrIdx = random_vec3(1.1f, 2.5f);
+        float const cosa = fabsf(vec3_dot(n, i));
+        float const maxIdx = fmaxf(refrIdx.x, fmaxf(refrIdx.y, refrIdx.z));
+        float const minIdx = fminf(refrIdx.x, fminf(refrIdx.y, refrIdx.z));
+        float const num = 1.0f - cosa * cosa;
+        if (fabsf(1.0f - num * maxIdx * maxIdx) > 1e-3f && fabsf(1.0f - num * minIdx * minIdx) > 1e-3f) {
+            check_refract(n, i, refrIdx);
+        }
+    }
+
+    // Vectors too short to normalize become zero on both backends.
+    for (uint32_t k = 0; k < 64; ++k)
+    {
+        Vec3 const tiny = random_vec3(-0.2f * PRECISION, 0.2f * PRECISION);
+        float const tinyArray[3] = {tiny.x, tiny.y, tiny.z};
+        float expected[3];
+
+        scalar_vec3_norm(tinyArray, expected);
+        check("vec3_norm (degenerate)", vec3_norm(tiny), expected, 0.0f, 0.0f);
+    }
+
+    check_total_internal_reflection();
+
+    printf("vec3: %u of %u checks failed\n", failureCount, checkCount);
+
+    return failureCount == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
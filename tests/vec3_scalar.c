@@ -0,0 +1,52 @@
+#define TRAYRACING_IMPLEMENTATION
+#include "trayracing/trayracing.h"
+
+// The scalar vec3 backend behind plain float arrays, linked into the TRAYRACING_SIMD build of vec3.c so that both
+// backends can be called from one program.
+
+static Vec3 vec3_load(float const a[3])
+{
+    return LITERAL(Vec3){.x = a[0], .y = a[1], .z = a[2]};
+}
+
+static void vec3_store(Vec3 a, float out[3])
+{
+    out[0] = a.x;
+    out[1] = a.y;
+    out[2] = a.z;
+}
+
+float scalar_vec3_dot(float const a[3], float const b[3])
+{
+    return vec3_dot(vec3_load(a), vec3_load(b));
+}
+
+float scalar_vec3_length(float const a[3])
+{
+    return vec3_length(vec3_load(a));
+}
+
+void scalar_vec3_norm(float const a[3], float out[3])
+{
+    vec3_store(vec3_norm(vec3_load(a)), out);
+}
+
+void scalar_vec3_cross(float const a[3], float const b[3], float out[3])
+{
+    vec3_store(vec3_cross(vec3_load(a), vec3_load(b)), out);
+}
+
+void scalar_vec3_reflect(float const n[3], float const v[3], float out[3])
+{
+    vec3_store(vec3_reflect(vec3_load(n), vec3_load(v)), out);
+}
+
+void scalar_vec3_refract(float const n[3], float const i[3], float const refrIdx[3], float out[3])
+{
+    vec3_store(vec3_refract(vec3_load(n), vec3_load(i), vec3_load(refrIdx)), out);
+}
+
+void scalar_vec3_lerp(float const a[3], float const b[3], float t, float out[3])
+{
+    vec3_store(vec3_lerp(vec3_load(a), vec3_load(b), t), out);
+}